@@ -56,7 +56,7 @@ void AnalysisGenerator::fn_stringify()
         if (ins.oprnd_count() >= 1)
         {
             this->append(" ");
-            if (ins.op == Opcode::IJmp || ins.op == Opcode::ICjmp)
+            if (op_is_jump(ins.op))
                 this->hex(ins.oprnd1);
             else
                 this->append(to_string(ins.oprnd1));
@@ -66,8 +66,15 @@ void AnalysisGenerator::fn_stringify()
             this->append(" ");
             this->append(to_string(ins.oprnd2));
         }
+        if (ins.oprnd_count() >= 3)
+        {
+            this->append(" ");
+            this->append(to_string(ins.oprnd3));
+        }
 
-        if (ins.op == Opcode::IConst)
+        if (ins.op == Opcode::IConst || ins.op == Opcode::ITGetK ||
+            ins.op == Opcode::ITSetK || ins.op == Opcode::ISelf ||
+            ins.op == Opcode::IGGetK || ins.op == Opcode::IGSetK)
         {
             this->append(" <");
             this->append(this->fn->constants[ins.oprnd1]);
@@ -0,0 +1,221 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <set.h>
+#include "table.h"
+#include "gc.h"
+
+using namespace luayed;
+
+// Micro-benchmarks for the runtime's core data structures. Run a release
+// build, the numbers of an unoptimized one mean nothing.
+
+class BenchAllocator : public IAllocator
+{
+public:
+    void *allocate_raw(size_t size) override
+    {
+        return malloc(size);
+    }
+    void deallocate_raw(void *ptr) override
+    {
+        free(ptr);
+    }
+};
+
+// The set the tables used before the swiss table: linear probing over
+// buckets that carry their own flag, hash and comparison called through
+// function pointers, modulo indexing.
+class LinearSet
+{
+private:
+    struct Bucket
+    {
+        TableElement val;
+        unsigned char flag;
+    };
+    Bucket *buffer;
+    size_t cap;
+    size_t count;
+    hash_t (*hash)(const LuaValue &v);
+    bool (*equal)(const LuaValue &a, const LuaValue &b);
+
+    Bucket *search(const TableElement &ele) const
+    {
+        size_t i = this->hash(ele.key) % this->cap;
+        while (this->buffer[i].flag != 0)
+        {
+            if (this->buffer[i].flag == 1 && this->equal(this->buffer[i].val.key, ele.key))
+                return this->buffer + i;
+            i = (i + 1) % this->cap;
+        }
+        return this->buffer + i;
+    }
+    void allocate(size_t cap)
+    {
+        this->cap = cap;
+        this->count = 0;
+        this->buffer = (Bucket *)calloc(cap, sizeof(Bucket));
+    }
+
+public:
+    LinearSet(hash_t (*hash)(const LuaValue &), bool (*equal)(const LuaValue &, const LuaValue &))
+        : hash(hash), equal(equal)
+    {
+        this->allocate(16);
+    }
+    ~LinearSet()
+    {
+        free(this->buffer);
+    }
+    void insert(const TableElement &ele)
+    {
+        if (this->count + 1 > this->cap * 3 / 4)
+        {
+            Bucket *old = this->buffer;
+            size_t oldcap = this->cap;
+            this->allocate(oldcap * 2);
+            for (size_t i = 0; i < oldcap; i++)
+                if (old[i].flag == 1)
+                    this->insert(old[i].val);
+            free(old);
+        }
+        Bucket *b = this->search(ele);
+        if (b->flag != 1)
+            this->count++;
+        b->val = ele;
+        b->flag = 1;
+    }
+    TableElement *get(const TableElement &ele) const
+    {
+        Bucket *b = this->search(ele);
+        return b->flag == 1 ? &b->val : nullptr;
+    }
+};
+
+bool value_equal(const LuaValue &a, const LuaValue &b)
+{
+    return a == b;
+}
+
+LuaValue int_value(linteger i)
+{
+    LuaValue v;
+    v.set_int(i);
+    return v;
+}
+LuaValue float_value(lnumber n)
+{
+    LuaValue v;
+    v.kind = LuaType::LVNumber;
+    v.data.n = n;
+    return v;
+}
+LuaValue object_value(void *ptr)
+{
+    LuaValue v;
+    v.kind = LuaType::LVTable;
+    v.data.ptr = ptr;
+    return v;
+}
+
+template <typename S>
+double lookup_ns(const S &set, const vector<LuaValue> &keys, size_t rounds, size_t &hits)
+{
+    LuaValue nil;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+        for (const LuaValue &k : keys)
+            hits += set.get(TableElement(k, nil)) != nullptr;
+    std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    return took.count() / (rounds * keys.size());
+}
+
+void bench_set(const char *name, const vector<LuaValue> &keys, const vector<LuaValue> &misses)
+{
+    BenchAllocator allocator;
+    Set<TableElement, TableHash, TableEq> swiss;
+    swiss.init(&allocator);
+    LinearSet linear(luavalue_hash, value_equal);
+    for (const LuaValue &k : keys)
+    {
+        swiss.insert(TableElement(k, k));
+        linear.insert(TableElement(k, k));
+    }
+    size_t rounds = 1000000 / keys.size() + 1;
+    size_t hits = 0;
+    double lhit = lookup_ns(linear, keys, rounds, hits);
+    double shit = lookup_ns(swiss, keys, rounds, hits);
+    double lmiss = lookup_ns(linear, misses, rounds, hits);
+    double smiss = lookup_ns(swiss, misses, rounds, hits);
+    printf("%-24s %8zu  hit %6.2f -> %6.2f ns  miss %6.2f -> %6.2f ns\n",
+           name, keys.size(), lhit, shit, lmiss, smiss);
+    if (hits != 2 * rounds * keys.size())
+        printf("  lookups disagree\n");
+    swiss.destroy();
+}
+
+// full collections of a heap that is all alive: a tree of tables with
+// eight children each, every table also pointing to one of the tables
+// created before it
+void bench_mark(size_t tables)
+{
+    LuaRuntime rt(nullptr);
+    LuaValue root = rt.create_table();
+    rt.stack_push(root);
+    vector<LuaValue> all{root};
+    unsigned seed = 1;
+    for (size_t i = 1; i < tables; i++)
+    {
+        LuaValue t = rt.create_table();
+        rt.table_set(all[(i - 1) / 8], int_value((i - 1) % 8 + 1), t);
+        seed = seed * 1103515245 + 12345;
+        rt.table_set(t, int_value(0), all[seed % all.size()]);
+        all.push_back(t);
+    }
+    size_t heap = rt.arena_stats().used;
+    size_t most = std::max(std::thread::hardware_concurrency(), 1u);
+    double serial = 0;
+    for (size_t threads = 1; threads <= most; threads *= 2)
+    {
+        rt.set_gc_threads(threads);
+        rt.collector()->run();
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < 3; r++)
+            rt.collector()->run();
+        std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+        double ms = took.count() / 3;
+        if (threads == 1)
+            serial = ms;
+        printf("%8zu tables %6zu MB  %3zu threads %9.2f ms  x%.2f\n",
+               tables, heap >> 20, threads, ms, serial / ms);
+    }
+}
+
+int main()
+{
+    printf("table set lookups, linear probing -> swiss table (group width %d)\n", SET_GROUP_WIDTH);
+    for (size_t n : {16, 1000})
+    {
+        vector<LuaValue> ints, intmiss, floats, floatmiss, ptrs, ptrmiss;
+        vector<char> objects(2 * n * 32);
+        for (size_t i = 0; i < n; i++)
+        {
+            ints.push_back(int_value(i * 8));
+            intmiss.push_back(int_value(i * 8 + 3));
+            floats.push_back(float_value(i + 0.25));
+            floatmiss.push_back(float_value(i + 0.75));
+            ptrs.push_back(object_value(objects.data() + i * 32));
+            ptrmiss.push_back(object_value(objects.data() + (n + i) * 32));
+        }
+        bench_set("integer keys", ints, intmiss);
+        bench_set("float keys", floats, floatmiss);
+        bench_set("object keys", ptrs, ptrmiss);
+    }
+    printf("full collections, marking on more threads\n");
+    for (size_t n : {1 << 18, 1 << 21})
+        bench_mark(n);
+    return 0;
+}
@@ -0,0 +1,215 @@
+extern const char liblua_code [] = {102,
+117,
+110,
+99,
+116,
+105,
+111,
+110,
+32,
+105,
+112,
+97,
+105,
+114,
+115,
+40,
+116,
+41,
+10,
+32,
+32,
+32,
+32,
+114,
+101,
+116,
+117,
+114,
+110,
+32,
+102,
+117,
+110,
+99,
+116,
+105,
+111,
+110,
+40,
+115,
+44,
+32,
+95,
+41,
+10,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+115,
+46,
+105,
+100,
+120,
+32,
+61,
+32,
+115,
+46,
+105,
+100,
+120,
+32,
+43,
+32,
+49,
+10,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+105,
+102,
+32,
+116,
+91,
+115,
+46,
+105,
+100,
+120,
+93,
+32,
+116,
+104,
+101,
+110,
+10,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+114,
+101,
+116,
+117,
+114,
+110,
+32,
+115,
+46,
+105,
+100,
+120,
+44,
+32,
+116,
+91,
+115,
+46,
+105,
+100,
+120,
+93,
+10,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+101,
+108,
+115,
+101,
+10,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+114,
+101,
+116,
+117,
+114,
+110,
+32,
+110,
+105,
+108,
+44,
+32,
+110,
+105,
+108,
+10,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+32,
+101,
+110,
+100,
+10,
+32,
+32,
+32,
+32,
+101,
+110,
+100,
+44,
+32,
+123,
+32,
+105,
+100,
+120,
+32,
+61,
+32,
+48,
+32,
+125,
+44,
+32,
+110,
+105,
+108,
+10,
+101,
+110,
+100,
+0,
+};
\ No newline at end of file
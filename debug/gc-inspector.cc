@@ -13,6 +13,7 @@ const char *atynames[] = {
     [AllocType::ATTable] = "table",
     [AllocType::ATFunction] = "function",
     [AllocType::ATBinary] = "binary",
+    [AllocType::ATInteger] = "integer",
 };
 
 int GCInspector::get_id(void *ptr)
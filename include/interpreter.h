@@ -3,12 +3,20 @@
 
 #include "runtime.h"
 #include "lerror.h"
+#include <cstring>
+#include <cmath>
+
 
 namespace luayed
 {
+    template <typename RT>
     class Interpreter;
 
-    typedef void (Interpreter::*opimpl)();
+    template <typename RT>
+    using opimpl = void (Interpreter<RT>::*)(const Dinstruction &);
+
+    // parses a whole string as a Lua numeral
+    bool str_to_number(const char *str, lnumber *num);
 
     enum class InterpreterState
     {
@@ -24,7 +32,9 @@ namespace luayed
         GT,
         GE,
         LT,
-        LE
+        LE,
+        EQ,
+        NE
     };
 
     enum class Calculation
@@ -46,6 +56,9 @@ namespace luayed
         CalcSHL,
     };
 
+    // the interpreter is bound statically to its runtime type, so that
+    // LuaRuntime's stack and constant accessors are inlined into the handlers.
+    template <typename RT>
     class Interpreter : public IInterpreter
     {
     public:
@@ -56,14 +69,17 @@ namespace luayed
         void config_error_metadata(bool val);
 
     private:
-        static opimpl optable[256];
+        static opimpl<RT> optable[256];
+        // opcodes after which the collector is polled, backward jumps
+        // are polled as well so that every loop contains a safepoint
+        static bool safepoints[256];
         static bool is_initialized;
 
         size_t ip = 0;
         size_t pip = 0;
-        lbyte op;
-        size_t arg1;
-        size_t arg2;
+        // decoded code of the running function, rewritten in place when
+        // instructions are quickened. null while executing a single op
+        Dinstruction *decoded = nullptr;
 
         bool config_error_metadata_v = true;
 
@@ -71,89 +87,1639 @@ namespace luayed
         size_t argc = 0;
         InterpreterState state = InterpreterState::Run;
 
-        IRuntime *rt = nullptr;
+        RT *rt = nullptr;
 
-        lbyte iread();
-        size_t fetch(lbyte *bin);
-        void exec();
+        void exec(const Dinstruction &ins);
+        void loop();
 
-        bool check_whole(lnumber num);
         void push_bool(bool b);
         void generate_error(Lerror error);
         bool compare();
-        void compare(Comparison cmp);
+        void compare(Comparison cmp, Opcode quick);
+        void compare_nn(Comparison cmp, Opcode generic);
+        bool compare(Comparison cmp, LuaValue a, LuaValue b, bool &rsl);
+        void branch(const Dinstruction &ins, Comparison cmp, bool expect);
+        template <typename N>
+        bool for_continue(N idx, N limit, N step);
         bool compare_number(LuaValue &a, LuaValue &b, Comparison cmp);
         bool compare_string(LuaValue &a, LuaValue &b, Comparison cmp);
         LuaValue hookread(Hook *hook);
         void hookwrite(Hook *hook, LuaValue value);
-        void arith(Calculation ar);
+        void arith(Calculation ar, Opcode quick);
+        void arith_nn(Calculation ar, Opcode generic);
+        void quicken(Opcode op);
+        bool arith(Calculation ar, LuaValue a, LuaValue b, LuaValue &rsl);
+        LuaValue arith_number(Calculation ar, LuaValue a, LuaValue b);
+        LuaValue reg_read(size_t reg);
+        void reg_write(size_t reg, LuaValue value);
+        void reg_arith(const Dinstruction &ins, Calculation ar, Opcode quick);
+        void reg_arith_nn(const Dinstruction &ins, Calculation ar, Opcode generic);
         void binary(Calculation bin);
         lnumber arith_calc(Calculation ar, lnumber a, lnumber b);
+        bool arith_int(Calculation ar, linteger a, linteger b, linteger &rsl);
+        bool to_int(LuaValue v, linteger &i);
         int64_t bin_calc(Calculation bin, int64_t a, int64_t b);
-        LuaValue parse_number(const char *str);
+        LuaValue parse_number(LuaValue s);
         LuaValue concat(LuaValue s1, LuaValue s2);
         LuaValue error_to_string(Lerror error);
         LuaValue lua_type_to_string(LuaType t);
         LuaValue error_add_meta(LuaValue e);
 
-        void i_add();
-        void i_sub();
-        void i_mult();
-        void i_flrdiv();
-        void i_fltdiv();
-        void i_mod();
-        void i_pow();
-        void i_concat();
-        void i_bor();
-        void i_band();
-        void i_bxor();
-        void i_shr();
-        void i_shl();
-
-        void i_len();
-        void i_neg();
-        void i_not();
-        void i_bnot();
-
-        void i_lt();
-        void i_gt();
-        void i_ge();
-        void i_le();
-        void i_eq();
-        void i_ne();
-
-        void i_tget();
-        void i_tset();
-        void i_tnew();
-        void i_tlist();
-        void i_gget();
-        void i_gset();
-        void i_nil();
-        void i_true();
-        void i_false();
-
-        void i_ret();
-
-        void i_call();
-        void i_tcall();
-        void i_vargs();
-        void i_jmp();
-        void i_cjmp();
-
-        void i_const();
-        void i_fconst();
-
-        void i_local();
-        void i_lstore();
-        void i_blocal();
-        void i_blstore();
-        void i_upvalue();
-        void i_ustore();
-
-        void i_upush();
-        void i_upop();
-        void i_pop();
+        void i_add(const Dinstruction &ins);
+        void i_sub(const Dinstruction &ins);
+        void i_mult(const Dinstruction &ins);
+        void i_flrdiv(const Dinstruction &ins);
+        void i_fltdiv(const Dinstruction &ins);
+        void i_mod(const Dinstruction &ins);
+        void i_pow(const Dinstruction &ins);
+        void i_concat(const Dinstruction &ins);
+        void i_bor(const Dinstruction &ins);
+        void i_band(const Dinstruction &ins);
+        void i_bxor(const Dinstruction &ins);
+        void i_shr(const Dinstruction &ins);
+        void i_shl(const Dinstruction &ins);
+
+        void i_len(const Dinstruction &ins);
+        void i_neg(const Dinstruction &ins);
+        void i_not(const Dinstruction &ins);
+        void i_bnot(const Dinstruction &ins);
+
+        void i_lt(const Dinstruction &ins);
+        void i_gt(const Dinstruction &ins);
+        void i_ge(const Dinstruction &ins);
+        void i_le(const Dinstruction &ins);
+        void i_eq(const Dinstruction &ins);
+        void i_ne(const Dinstruction &ins);
+
+        void i_tget(const Dinstruction &ins);
+        void i_tset(const Dinstruction &ins);
+        void i_tnew(const Dinstruction &ins);
+        void i_tclone(const Dinstruction &ins);
+        void i_tlist(const Dinstruction &ins);
+        void i_gget(const Dinstruction &ins);
+        void i_gset(const Dinstruction &ins);
+        void i_nil(const Dinstruction &ins);
+        void i_true(const Dinstruction &ins);
+        void i_false(const Dinstruction &ins);
+
+        void i_ret(const Dinstruction &ins);
+
+        void i_call(const Dinstruction &ins);
+        void i_tcall(const Dinstruction &ins);
+        void i_vargs(const Dinstruction &ins);
+        void i_jmp(const Dinstruction &ins);
+        void i_cjmp(const Dinstruction &ins);
+        void i_fjmp(const Dinstruction &ins);
+        void i_andjmp(const Dinstruction &ins);
+        void i_orjmp(const Dinstruction &ins);
+        void i_forprep(const Dinstruction &ins);
+        void i_forloop(const Dinstruction &ins);
+
+        void i_const(const Dinstruction &ins);
+        void i_fconst(const Dinstruction &ins);
+
+        void i_local(const Dinstruction &ins);
+        void i_lstore(const Dinstruction &ins);
+        void i_blocal(const Dinstruction &ins);
+        void i_blstore(const Dinstruction &ins);
+        void i_upvalue(const Dinstruction &ins);
+        void i_ustore(const Dinstruction &ins);
+
+        void i_upush(const Dinstruction &ins);
+        void i_upop(const Dinstruction &ins);
+        void i_pop(const Dinstruction &ins);
+
+        void i_radd(const Dinstruction &ins);
+        void i_rsub(const Dinstruction &ins);
+        void i_rmult(const Dinstruction &ins);
+        void i_rflrdiv(const Dinstruction &ins);
+        void i_rfltdiv(const Dinstruction &ins);
+        void i_rmod(const Dinstruction &ins);
+        void i_rpow(const Dinstruction &ins);
+        void i_rmove(const Dinstruction &ins);
+
+        void i_rjeq(const Dinstruction &ins);
+        void i_rjne(const Dinstruction &ins);
+        void i_rjlt(const Dinstruction &ins);
+        void i_rjle(const Dinstruction &ins);
+        void i_rjgt(const Dinstruction &ins);
+        void i_rjge(const Dinstruction &ins);
+        void i_rjnlt(const Dinstruction &ins);
+        void i_rjnle(const Dinstruction &ins);
+        void i_rjngt(const Dinstruction &ins);
+        void i_rjnge(const Dinstruction &ins);
+
+        void i_tgetk(const Dinstruction &ins);
+        void i_tsetk(const Dinstruction &ins);
+        void i_self(const Dinstruction &ins);
+        void i_ggetk(const Dinstruction &ins);
+        void i_gsetk(const Dinstruction &ins);
+
+        void i_addnn(const Dinstruction &ins);
+        void i_subnn(const Dinstruction &ins);
+        void i_multnn(const Dinstruction &ins);
+        void i_flrdivnn(const Dinstruction &ins);
+        void i_fltdivnn(const Dinstruction &ins);
+        void i_modnn(const Dinstruction &ins);
+        void i_pownn(const Dinstruction &ins);
+        void i_concatss(const Dinstruction &ins);
+        void i_genn(const Dinstruction &ins);
+        void i_gtnn(const Dinstruction &ins);
+        void i_lenn(const Dinstruction &ins);
+        void i_ltnn(const Dinstruction &ins);
+        void i_raddnn(const Dinstruction &ins);
+        void i_rsubnn(const Dinstruction &ins);
+        void i_rmultnn(const Dinstruction &ins);
+        void i_rflrdivnn(const Dinstruction &ins);
+        void i_rfltdivnn(const Dinstruction &ins);
+        void i_rmodnn(const Dinstruction &ins);
+        void i_rpownn(const Dinstruction &ins);
     };
+
+#if defined(LUAYED_THREADED_DISPATCH) && defined(__GNUC__)
+#define INTERPRETER_THREADED
+#endif
+
+    // opcodes whose handlers neither read nor write the instruction pointer
+#define INTERPRETER_OPTABLE(X)  \
+    X(IAdd, i_add)              \
+    X(ISub, i_sub)              \
+    X(IMult, i_mult)            \
+    X(IFlrDiv, i_flrdiv)        \
+    X(IFltDiv, i_fltdiv)        \
+    X(IMod, i_mod)              \
+    X(IPow, i_pow)              \
+    X(IBOr, i_bor)              \
+    X(IBAnd, i_band)            \
+    X(IBXor, i_bxor)            \
+    X(ISHR, i_shr)              \
+    X(ISHL, i_shl)              \
+    X(ILength, i_len)           \
+    X(INegate, i_neg)           \
+    X(INot, i_not)              \
+    X(IBNot, i_bnot)            \
+    X(IEq, i_eq)                \
+    X(INe, i_ne)                \
+    X(IGe, i_ge)                \
+    X(IGt, i_gt)                \
+    X(ILe, i_le)                \
+    X(ILt, i_lt)                \
+    X(ITGet, i_tget)            \
+    X(ITSet, i_tset)            \
+    X(IGGet, i_gget)            \
+    X(IGSet, i_gset)            \
+    X(INil, i_nil)              \
+    X(ITrue, i_true)            \
+    X(IFalse, i_false)          \
+    X(IRet, i_ret)              \
+    X(IVargs, i_vargs)          \
+    X(IConst, i_const)          \
+    X(ILocal, i_local)          \
+    X(ILStore, i_lstore)        \
+    X(IBLocal, i_blocal)        \
+    X(IBLStore, i_blstore)      \
+    X(IUpvalue, i_upvalue)      \
+    X(IUStore, i_ustore)        \
+    X(IUPop, i_upop)            \
+    X(IPop, i_pop)              \
+    X(IRAdd, i_radd)            \
+    X(IRSub, i_rsub)            \
+    X(IRMult, i_rmult)          \
+    X(IRFlrDiv, i_rflrdiv)      \
+    X(IRFltDiv, i_rfltdiv)      \
+    X(IRMod, i_rmod)            \
+    X(IRPow, i_rpow)            \
+    X(IRMove, i_rmove)          \
+    X(ITGetK, i_tgetk)          \
+    X(ITSetK, i_tsetk)          \
+    X(ISelf, i_self)            \
+    X(IGGetK, i_ggetk)          \
+    X(IGSetK, i_gsetk)          \
+    X(IAddNN, i_addnn)          \
+    X(ISubNN, i_subnn)          \
+    X(IMultNN, i_multnn)        \
+    X(IFlrDivNN, i_flrdivnn)    \
+    X(IFltDivNN, i_fltdivnn)    \
+    X(IModNN, i_modnn)          \
+    X(IPowNN, i_pownn)          \
+    X(IGeNN, i_genn)            \
+    X(IGtNN, i_gtnn)            \
+    X(ILeNN, i_lenn)            \
+    X(ILtNN, i_ltnn)            \
+    X(IRAddNN, i_raddnn)        \
+    X(IRSubNN, i_rsubnn)        \
+    X(IRMultNN, i_rmultnn)      \
+    X(IRFlrDivNN, i_rflrdivnn)  \
+    X(IRFltDivNN, i_rfltdivnn)  \
+    X(IRModNN, i_rmodnn)        \
+    X(IRPowNN, i_rpownn)
+
+    // opcodes that create objects, the collector is polled after them
+#define INTERPRETER_OPTABLE_ALLOC(X) \
+    X(ITNew, i_tnew)                 \
+    X(ITClone, i_tclone)             \
+    X(ITList, i_tlist)               \
+    X(IConcat, i_concat)             \
+    X(IConcatSS, i_concatss)         \
+    X(IFConst, i_fconst)             \
+    X(IUPush, i_upush)
+
+    // opcodes that transfer control
+#define INTERPRETER_OPTABLE_CONTROL(X) \
+    X(ICall, i_call)                   \
+    X(ITCall, i_tcall)                 \
+    X(IJmp, i_jmp)                     \
+    X(ICjmp, i_cjmp)                   \
+    X(IFjmp, i_fjmp)                   \
+    X(IAndJmp, i_andjmp)               \
+    X(IOrJmp, i_orjmp)
+
+    // conditional jumps that are executed through their handlers
+#define INTERPRETER_OPTABLE_BRANCH(X) \
+    X(IRJEq, i_rjeq)                  \
+    X(IRJNe, i_rjne)                  \
+    X(IRJLt, i_rjlt)                  \
+    X(IRJLe, i_rjle)                  \
+    X(IRJGt, i_rjgt)                  \
+    X(IRJGe, i_rjge)                  \
+    X(IRJNLt, i_rjnlt)                \
+    X(IRJNLe, i_rjnle)                \
+    X(IRJNGt, i_rjngt)                \
+    X(IRJNGe, i_rjnge)                \
+    X(IForPrep, i_forprep)            \
+    X(IForLoop, i_forloop)
+
+    template <typename RT>
+    opimpl<RT> Interpreter<RT>::optable[256] = {};
+    template <typename RT>
+    bool Interpreter<RT>::safepoints[256] = {};
+    template <typename RT>
+    bool Interpreter<RT>::is_initialized = false;
+
+    template <typename RT>
+    void Interpreter<RT>::optable_init()
+    {
+#define OPTABLE_ENTRY(OPC, FN) Interpreter<RT>::optable[OPC] = &Interpreter<RT>::FN;
+        INTERPRETER_OPTABLE(OPTABLE_ENTRY)
+        INTERPRETER_OPTABLE_ALLOC(OPTABLE_ENTRY)
+        INTERPRETER_OPTABLE_CONTROL(OPTABLE_ENTRY)
+        INTERPRETER_OPTABLE_BRANCH(OPTABLE_ENTRY)
+#undef OPTABLE_ENTRY
+#define SAFEPOINT_ENTRY(OPC, FN) Interpreter<RT>::safepoints[OPC] = true;
+        INTERPRETER_OPTABLE_ALLOC(SAFEPOINT_ENTRY)
+        SAFEPOINT_ENTRY(ICall, i_call)
+        SAFEPOINT_ENTRY(ITCall, i_tcall)
+#undef SAFEPOINT_ENTRY
+    }
+
+    template <typename RT>
+    Interpreter<RT>::Interpreter()
+    {
+        if (!Interpreter<RT>::is_initialized)
+        {
+            Interpreter<RT>::is_initialized = true;
+            Interpreter<RT>::optable_init();
+        }
+    }
+
+    template <typename RT>
+    Fnresult Interpreter<RT>::run(IRuntime *rt, Bytecode op)
+    {
+        this->rt = static_cast<RT *>(rt);
+        if (this->rt->error_raised())
+        {
+            this->state = InterpreterState::Error;
+        }
+        else
+        {
+            Dinstruction ins{};
+            uint32_t textpos;
+            predecode(op.bytes, op.count, &ins, &textpos);
+            this->decoded = nullptr;
+            this->exec(ins);
+        }
+
+        Fnresult rs;
+        if (this->state == InterpreterState::Error)
+        {
+            rs.kind = Fnresult::Error;
+        }
+        if (this->state == InterpreterState::End)
+        {
+            rs.kind = Fnresult::Ret;
+            rs.retc = this->retc;
+        }
+        this->retc = 0;
+        this->state = InterpreterState::Run;
+        return rs;
+    }
+    template <typename RT>
+    Fnresult Interpreter<RT>::run(IRuntime *rt)
+    {
+        this->rt = static_cast<RT *>(rt);
+        this->ip = this->rt->load_ip();
+        this->decoded = this->rt->code();
+        if (this->rt->error_raised())
+        {
+            this->state = InterpreterState::Error;
+        }
+        if (this->state == InterpreterState::Run)
+            this->loop();
+        if (this->config_error_metadata_v && this->state == InterpreterState::Error && !this->rt->error_metadata())
+        {
+            LuaValue e = this->rt->get_error();
+            if (e.kind == LuaType::LVString)
+            {
+                this->rt->set_error(this->error_add_meta(e));
+                this->rt->error_metadata(true);
+            }
+        }
+        Fnresult rs;
+        if (this->state == InterpreterState::Error)
+        {
+            rs.kind = Fnresult::Error;
+        }
+        if (this->state == InterpreterState::End)
+        {
+            rs.kind = Fnresult::Ret;
+            rs.retc = this->retc;
+        }
+        if (this->state == InterpreterState::Call)
+        {
+            rs.kind = Fnresult::Call;
+            rs.retc = this->retc;
+            rs.argc = this->argc;
+        }
+        if (this->state == InterpreterState::Tail)
+        {
+            rs.kind = Fnresult::Tail;
+            rs.argc = this->argc;
+        }
+        this->retc = 0;
+        this->state = InterpreterState::Run;
+        return rs;
+    }
+    template <typename RT>
+    LuaValue Interpreter<RT>::error_add_meta(LuaValue e)
+    {
+        LuaValue s1 = this->rt->chunkname();
+        if (s1.kind == LuaType::LVNil)
+        {
+            s1 = this->rt->create_string("[?]");
+        }
+        dbginfo_t dbginfo = this->rt->dbgmd()[this->rt->textpos()[this->pip]];
+        if (DEBUG_INFO_GET_TYPE(dbginfo) == DEBUG_INFO_TYPE_NUMFOR)
+            s1 = this->concat(s1, this->rt->create_string(" [numeric for]"));
+        else if (DEBUG_INFO_GET_TYPE(dbginfo) == DEBUG_INFO_TYPE_GENFOR)
+            s1 = this->concat(s1, this->rt->create_string(" [generic for]"));
+        LuaValue s2 = this->rt->create_string(":");
+        LuaValue s3 = this->rt->create_string((linteger)DEBUG_INFO_GET_LINE(dbginfo));
+        LuaValue s4 = this->rt->create_string(": ");
+        s1 = this->concat(s1, s2);
+        s1 = this->concat(s1, s3);
+        s1 = this->concat(s1, s4);
+        s1 = this->concat(s1, e);
+        return s1;
+    }
+#ifdef INTERPRETER_THREADED
+    template <typename RT>
+    void Interpreter<RT>::loop()
+    {
+        static void *labels[256];
+        static bool labels_ready = false;
+        if (!labels_ready)
+        {
+            for (size_t i = 0; i < 256; i++)
+                labels[i] = &&op_invalid;
+#define THREADED_LABEL(OPC, FN) labels[OPC] = &&op_##OPC;
+            INTERPRETER_OPTABLE(THREADED_LABEL)
+            INTERPRETER_OPTABLE_ALLOC(THREADED_LABEL)
+            INTERPRETER_OPTABLE_CONTROL(THREADED_LABEL)
+            INTERPRETER_OPTABLE_BRANCH(THREADED_LABEL)
+#undef THREADED_LABEL
+            labels_ready = true;
+        }
+
+        const Dinstruction *code = this->decoded;
+        const Dinstruction *ins = nullptr;
+        size_t ip = this->ip;
+
+#define THREADED_DISPATCH()                 \
+    {                                       \
+        ins = &code[ip];                    \
+        this->pip = ip++;                   \
+        goto *labels[ins->op];              \
+    }
+#define THREADED_NEXT()                           \
+    {                                             \
+        if (this->state != InterpreterState::Run) \
+            goto op_end;                          \
+        THREADED_DISPATCH();                      \
+    }
+#define THREADED_SAFEPOINT()                  \
+    {                                         \
+        this->rt->check_garbage_collection(); \
+        THREADED_NEXT();                      \
+    }
+#define THREADED_BACKEDGE()                       \
+    {                                             \
+        if (ip <= this->pip)                      \
+            this->rt->check_garbage_collection(); \
+        THREADED_NEXT();                          \
+    }
+#define THREADED_HANDLER(OPC, FN) \
+    op_##OPC:                     \
+    this->FN(*ins);               \
+    THREADED_NEXT();
+#define THREADED_ALLOC(OPC, FN) \
+    op_##OPC:                   \
+    this->FN(*ins);             \
+    THREADED_SAFEPOINT();
+#define THREADED_BRANCH(OPC, FN) \
+    op_##OPC:                    \
+    this->ip = ip;               \
+    this->FN(*ins);              \
+    ip = this->ip;               \
+    THREADED_BACKEDGE();
+
+        THREADED_DISPATCH();
+        INTERPRETER_OPTABLE(THREADED_HANDLER)
+        INTERPRETER_OPTABLE_ALLOC(THREADED_ALLOC)
+        INTERPRETER_OPTABLE_BRANCH(THREADED_BRANCH)
+
+    op_IJmp:
+        ip = ins->a;
+        THREADED_BACKEDGE();
+    op_ICjmp:
+        if (this->rt->stack_pop().truth())
+            ip = ins->a;
+        THREADED_BACKEDGE();
+    op_IFjmp:
+        if (!this->rt->stack_pop().truth())
+            ip = ins->a;
+        THREADED_BACKEDGE();
+    op_IAndJmp:
+        if (!this->rt->stack_back_read(1).truth())
+            ip = ins->a;
+        else
+            this->rt->stack_pop();
+        THREADED_NEXT();
+    op_IOrJmp:
+        if (this->rt->stack_back_read(1).truth())
+            ip = ins->a;
+        else
+            this->rt->stack_pop();
+        THREADED_NEXT();
+    op_ICall:
+        this->ip = ip;
+        this->i_call(*ins);
+        THREADED_SAFEPOINT();
+    op_ITCall:
+        this->ip = ip;
+        this->i_tcall(*ins);
+        THREADED_SAFEPOINT();
+    op_invalid:
+        crash("invalid opcode");
+    op_end:
+        this->ip = ip;
+
+#undef THREADED_HANDLER
+#undef THREADED_ALLOC
+#undef THREADED_BRANCH
+#undef THREADED_BACKEDGE
+#undef THREADED_SAFEPOINT
+#undef THREADED_NEXT
+#undef THREADED_DISPATCH
+    }
+#else
+    template <typename RT>
+    void Interpreter<RT>::loop()
+    {
+        while (this->state == InterpreterState::Run)
+        {
+            this->pip = this->ip;
+            const Dinstruction &ins = this->rt->code()[this->ip++];
+            lbyte op = ins.op;
+            this->exec(ins);
+            if (safepoints[op] || this->ip <= this->pip)
+                this->rt->check_garbage_collection();
+        }
+    }
+#endif
+    template <typename RT>
+    void Interpreter<RT>::exec(const Dinstruction &ins)
+    {
+        opimpl<RT> handler = optable[ins.op];
+        (this->*handler)(ins);
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::push_bool(bool b)
+    {
+        this->rt->stack_push(this->rt->create_boolean(b));
+    }
+
+    template <typename RT>
+    lnumber Interpreter<RT>::arith_calc(Calculation ar, lnumber a, lnumber b)
+    {
+        if (ar == Calculation::CalcAdd)
+            return a + b;
+        if (ar == Calculation::CalcSub)
+            return a - b;
+        if (ar == Calculation::CalcMult)
+            return a * b;
+        if (ar == Calculation::CalcFltDiv)
+            return a / b;
+        if (ar == Calculation::CalcFlrDiv)
+            return floor(a / b);
+        if (ar == Calculation::CalcMod)
+            return fmod(a, b);
+        if (ar == Calculation::CalcPow)
+            return pow(a, b);
+        return 0;
+    }
+
+    template <typename RT>
+    bool Interpreter<RT>::arith_int(Calculation ar, linteger a, linteger b, linteger &rsl)
+    {
+        // integer arithmetic wraps around like in Lua 5.3, division by zero
+        // and the float-only operators are left to arith_calc
+        uint64_t ua = a, ub = b;
+        if (ar == Calculation::CalcAdd)
+            rsl = (linteger)(ua + ub);
+        else if (ar == Calculation::CalcSub)
+            rsl = (linteger)(ua - ub);
+        else if (ar == Calculation::CalcMult)
+            rsl = (linteger)(ua * ub);
+        else if (b == 0)
+            return false;
+        else if (ar == Calculation::CalcFlrDiv)
+        {
+            if (b == -1)
+                rsl = (linteger)(0 - ua);
+            else
+            {
+                rsl = a / b;
+                if ((a % b != 0) && ((a ^ b) < 0))
+                    rsl -= 1;
+            }
+        }
+        else if (ar == Calculation::CalcMod)
+        {
+            if (b == -1)
+                rsl = 0;
+            else
+            {
+                rsl = a % b;
+                if (rsl != 0 && (rsl ^ b) < 0)
+                    rsl += b;
+            }
+        }
+        else
+            return false;
+        return true;
+    }
+
+    template <typename RT>
+    LuaValue Interpreter<RT>::arith_number(Calculation ar, LuaValue a, LuaValue b)
+    {
+        linteger i;
+        if (a.is_int() && b.is_int() && this->arith_int(ar, a.data.i, b.data.i, i))
+            return this->rt->create_integer(i);
+        return this->rt->create_number(this->arith_calc(ar, a.number(), b.number()));
+    }
+
+    template <typename RT>
+    LuaValue Interpreter<RT>::parse_number(LuaValue s)
+    {
+        lnumber num;
+        if (!str_to_number(s.str(), &num))
+            return this->rt->create_nil();
+        return this->rt->create_number(num);
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::quicken(Opcode op)
+    {
+        if (this->decoded)
+            this->decoded[this->pip].op = op;
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::arith(Calculation ar, Opcode quick)
+    {
+        LuaValue b = this->rt->stack_pop();
+        LuaValue a = this->rt->stack_pop();
+        if (a.kind == LuaType::LVNumber && b.kind == LuaType::LVNumber)
+            this->quicken(quick);
+        LuaValue rsl;
+        if (this->arith(ar, a, b, rsl))
+            this->rt->stack_push(rsl);
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::arith_nn(Calculation ar, Opcode generic)
+    {
+        LuaValue b = this->rt->stack_pop();
+        LuaValue a = this->rt->stack_back_read(1);
+        if (a.kind != LuaType::LVNumber || b.kind != LuaType::LVNumber)
+        {
+            // the guess no longer holds, go back to the generic instruction
+            this->quicken(generic);
+            this->rt->stack_pop();
+            LuaValue rsl;
+            if (this->arith(ar, a, b, rsl))
+                this->rt->stack_push(rsl);
+            return;
+        }
+        this->rt->stack_back_write(1, this->arith_number(ar, a, b));
+    }
+
+    template <typename RT>
+    bool Interpreter<RT>::arith(Calculation ar, LuaValue a, LuaValue b, LuaValue &rsl)
+    {
+        LuaType at = a.kind;
+        LuaType bt = b.kind;
+
+        if (at == LuaType::LVString)
+            a = this->parse_number(a);
+        if (bt == LuaType::LVString)
+            b = this->parse_number(b);
+
+        if (a.kind != LuaType::LVNumber)
+        {
+            this->generate_error(error_invalid_operand(at));
+            return false;
+        }
+        if (b.kind != LuaType::LVNumber)
+        {
+            this->generate_error(error_invalid_operand(bt));
+            return false;
+        }
+
+        rsl = this->arith_number(ar, a, b);
+        return true;
+    }
+
+    template <typename RT>
+    LuaValue Interpreter<RT>::reg_read(size_t reg)
+    {
+        if (reg == REG_STACK)
+            return this->rt->stack_pop();
+        if (reg & REG_CONST)
+            return this->rt->rodata(reg & ~REG_CONST);
+        return this->rt->stack_read(reg);
+    }
+    template <typename RT>
+    void Interpreter<RT>::reg_write(size_t reg, LuaValue value)
+    {
+        if (reg == REG_STACK)
+            this->rt->stack_push(value);
+        else
+            this->rt->stack_write(reg, value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::reg_arith(const Dinstruction &ins, Calculation ar, Opcode quick)
+    {
+        // the right operand is read first, both may be popped off the stack
+        LuaValue b = this->reg_read(ins.c);
+        LuaValue a = this->reg_read(ins.b);
+        if (a.kind == LuaType::LVNumber && b.kind == LuaType::LVNumber)
+            this->quicken(quick);
+        LuaValue rsl;
+        if (this->arith(ar, a, b, rsl))
+            this->reg_write(ins.a, rsl);
+    }
+    template <typename RT>
+    void Interpreter<RT>::reg_arith_nn(const Dinstruction &ins, Calculation ar, Opcode generic)
+    {
+        LuaValue b = this->reg_read(ins.c);
+        LuaValue a = this->reg_read(ins.b);
+        if (a.kind != LuaType::LVNumber || b.kind != LuaType::LVNumber)
+        {
+            this->quicken(generic);
+            LuaValue rsl;
+            if (this->arith(ar, a, b, rsl))
+                this->reg_write(ins.a, rsl);
+            return;
+        }
+        this->reg_write(ins.a, this->arith_number(ar, a, b));
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::i_radd(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcAdd, Opcode::IRAddNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rsub(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcSub, Opcode::IRSubNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rmult(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcMult, Opcode::IRMultNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rflrdiv(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcFlrDiv, Opcode::IRFlrDivNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rfltdiv(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcFltDiv, Opcode::IRFltDivNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rmod(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcMod, Opcode::IRModNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rpow(const Dinstruction &ins)
+    {
+        this->reg_arith(ins, Calculation::CalcPow, Opcode::IRPowNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_raddnn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcAdd, Opcode::IRAdd);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rsubnn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcSub, Opcode::IRSub);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rmultnn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcMult, Opcode::IRMult);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rflrdivnn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcFlrDiv, Opcode::IRFlrDiv);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rfltdivnn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcFltDiv, Opcode::IRFltDiv);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rmodnn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcMod, Opcode::IRMod);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rpownn(const Dinstruction &ins)
+    {
+        this->reg_arith_nn(ins, Calculation::CalcPow, Opcode::IRPow);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rmove(const Dinstruction &ins)
+    {
+        this->reg_write(ins.a, this->reg_read(ins.b));
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::i_add(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcAdd, Opcode::IAddNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_sub(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcSub, Opcode::ISubNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_mult(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcMult, Opcode::IMultNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_flrdiv(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcFlrDiv, Opcode::IFlrDivNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_fltdiv(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcFltDiv, Opcode::IFltDivNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_mod(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcMod, Opcode::IModNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_pow(const Dinstruction &ins)
+    {
+        this->arith(Calculation::CalcPow, Opcode::IPowNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_neg(const Dinstruction &ins)
+    {
+        LuaValue a = this->rt->stack_pop();
+        LuaType at = a.kind;
+        if (a.kind == LuaType::LVString)
+        {
+            a = this->parse_number(a);
+        }
+        if (a.kind != LuaType::LVNumber)
+        {
+            return this->generate_error(error_invalid_operand(at));
+        }
+        LuaValue num = a.is_int() ? this->rt->create_integer((linteger)(0 - (uint64_t)a.data.i))
+                                  : this->rt->create_number(-a.data.n);
+        this->rt->stack_push(num);
+    }
+    template <typename RT>
+    int64_t Interpreter<RT>::bin_calc(Calculation bin, int64_t a, int64_t b)
+    {
+        if (bin == Calculation::CalcAnd)
+            return a & b;
+        else if (bin == Calculation::CalcOr)
+            return a | b;
+        else if (bin == Calculation::CalcXor)
+            return a ^ b;
+        else if (bin == Calculation::CalcNot)
+            return ~a;
+        else if (bin == Calculation::CalcSHR)
+            return a >> b;
+        else if (bin == Calculation::CalcSHL)
+            return a << b;
+        return 0;
+    }
+    template <typename RT>
+    bool Interpreter<RT>::to_int(LuaValue v, linteger &i)
+    {
+        if (v.kind != LuaType::LVNumber)
+        {
+            this->generate_error(error_invalid_operand(v.kind));
+            return false;
+        }
+        if (v.is_int())
+            i = v.data.i;
+        else if (!number_to_int(v.data.n, &i))
+        {
+            this->generate_error(error_integer_representation());
+            return false;
+        }
+        return true;
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::binary(Calculation bin)
+    {
+        LuaValue b = this->rt->create_integer(0);
+        if (bin != Calculation::CalcNot)
+            b = this->rt->stack_pop();
+        LuaValue a = this->rt->stack_pop();
+
+        linteger ai, bi;
+        if (!this->to_int(a, ai) || !this->to_int(b, bi))
+            return;
+        this->rt->stack_push(this->rt->create_integer(this->bin_calc(bin, ai, bi)));
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_bor(const Dinstruction &ins)
+    {
+        return this->binary(Calculation::CalcOr);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_band(const Dinstruction &ins)
+    {
+        return this->binary(Calculation::CalcAnd);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_bxor(const Dinstruction &ins)
+    {
+        return this->binary(Calculation::CalcXor);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_bnot(const Dinstruction &ins)
+    {
+        return this->binary(Calculation::CalcNot);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_shr(const Dinstruction &ins)
+    {
+        return this->binary(Calculation::CalcSHR);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_shl(const Dinstruction &ins)
+    {
+        return this->binary(Calculation::CalcSHL);
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::i_not(const Dinstruction &ins)
+    {
+        LuaValue val = this->rt->stack_pop();
+        bool rsl = !val.truth();
+        this->push_bool(rsl);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_concat(const Dinstruction &ins)
+    {
+        LuaValue b = this->rt->stack_pop();
+        LuaValue a = this->rt->stack_pop();
+        if (a.kind == LuaType::LVString && b.kind == LuaType::LVString)
+            this->quicken(Opcode::IConcatSS);
+
+        if (a.is_int())
+            a = this->rt->create_string((linteger)a.data.i);
+        else if (a.kind == LuaType::LVNumber)
+            a = this->rt->create_string(a.number());
+        if (a.kind != LuaType::LVString)
+        {
+            return this->generate_error(error_invalid_operand(a.kind));
+        }
+
+        if (b.is_int())
+            b = this->rt->create_string((linteger)b.data.i);
+        else if (b.kind == LuaType::LVNumber)
+            b = this->rt->create_string(b.number());
+        if (b.kind != LuaType::LVString)
+        {
+            return this->generate_error(error_invalid_operand(b.kind));
+        }
+
+        LuaValue c = this->concat(a, b);
+        this->rt->stack_push(c);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_len(const Dinstruction &ins)
+    {
+        LuaValue s = this->rt->stack_pop();
+        if (s.kind == LuaType::LVString)
+            this->rt->stack_push(this->rt->create_integer(this->rt->length(s)));
+        else if (s.kind == LuaType::LVTable)
+            this->rt->stack_push(this->rt->create_integer(this->rt->table_length(s)));
+        else
+            return this->generate_error(error_invalid_operand(s.kind));
+    }
+
+    template <typename RT>
+    void Interpreter<RT>::compare(Comparison cmp, Opcode quick)
+    {
+        LuaValue b = this->rt->stack_pop();
+        LuaValue a = this->rt->stack_pop();
+        if (a.kind == LuaType::LVNumber && b.kind == LuaType::LVNumber)
+            this->quicken(quick);
+        bool rsl;
+        if (this->compare(cmp, a, b, rsl))
+            this->push_bool(rsl);
+    }
+    template <typename RT>
+    void Interpreter<RT>::compare_nn(Comparison cmp, Opcode generic)
+    {
+        LuaValue b = this->rt->stack_pop();
+        LuaValue a = this->rt->stack_back_read(1);
+        if (a.kind != LuaType::LVNumber || b.kind != LuaType::LVNumber)
+        {
+            this->quicken(generic);
+            this->rt->stack_pop();
+            bool rsl;
+            if (this->compare(cmp, a, b, rsl))
+                this->push_bool(rsl);
+            return;
+        }
+        this->rt->stack_back_write(1, this->rt->create_boolean(this->compare_number(a, b, cmp)));
+    }
+    template <typename RT>
+    bool Interpreter<RT>::compare(Comparison cmp, LuaValue a, LuaValue b, bool &rsl)
+    {
+        if (cmp == Comparison::EQ || cmp == Comparison::NE)
+        {
+            rsl = (a == b) == (cmp == Comparison::EQ);
+            return true;
+        }
+        if (a.kind != b.kind || (a.kind != LuaType::LVNumber && a.kind != LuaType::LVString))
+        {
+            this->generate_error(error_invalid_comparison(a.kind, b.kind));
+            return false;
+        }
+        else if (a.kind == LuaType::LVNumber)
+            rsl = this->compare_number(a, b, cmp);
+        else
+            rsl = this->compare_string(a, b, cmp);
+        return true;
+    }
+    template <typename RT>
+    void Interpreter<RT>::branch(const Dinstruction &ins, Comparison cmp, bool expect)
+    {
+        LuaValue b = this->reg_read(ins.c);
+        LuaValue a = this->reg_read(ins.b);
+        bool rsl;
+        if (this->compare(cmp, a, b, rsl) && rsl == expect)
+            this->ip = ins.a;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjeq(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::EQ, true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjne(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::NE, true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjlt(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::LT, true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjle(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::LE, true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjgt(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::GT, true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjge(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::GE, true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjnlt(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::LT, false);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjnle(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::LE, false);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjngt(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::GT, false);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_rjnge(const Dinstruction &ins)
+    {
+        this->branch(ins, Comparison::GE, false);
+    }
+    template <typename RT>
+    bool Interpreter<RT>::compare_number(LuaValue &a, LuaValue &b, Comparison cmp)
+    {
+        if (a.is_int() && b.is_int())
+        {
+            linteger x = a.data.i, y = b.data.i;
+            if (cmp == Comparison::GE)
+                return x >= y;
+            if (cmp == Comparison::GT)
+                return x > y;
+            if (cmp == Comparison::LE)
+                return x <= y;
+            return x < y;
+        }
+        lnumber x = a.number(), y = b.number();
+        if (cmp == Comparison::GE)
+            return x >= y;
+        if (cmp == Comparison::GT)
+            return x > y;
+        if (cmp == Comparison::LE)
+            return x <= y;
+        return x < y;
+    }
+    template <typename RT>
+    bool Interpreter<RT>::compare_string(LuaValue &a, LuaValue &b, Comparison cmp)
+    {
+        int order = strcmp(a.str(), b.str());
+        if (cmp == Comparison::GE)
+            return order >= 0;
+        if (cmp == Comparison::GT)
+            return order > 0;
+        if (cmp == Comparison::LE)
+            return order <= 0;
+        return order < 0;
+    }
+    template <typename RT>
+    LuaValue Interpreter<RT>::hookread(Hook *hook)
+    {
+        if (hook->is_detached)
+        {
+            return hook->val;
+        }
+        else
+        {
+            return *hook->original;
+        }
+    }
+    template <typename RT>
+    void Interpreter<RT>::hookwrite(Hook *hook, LuaValue value)
+    {
+        if (hook->is_detached)
+        {
+            this->rt->write_barrier(hook, value);
+            hook->val = value;
+        }
+        else
+        {
+            *hook->original = value;
+        }
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_lt(const Dinstruction &ins)
+    {
+        this->compare(Comparison::LT, Opcode::ILtNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_gt(const Dinstruction &ins)
+    {
+        this->compare(Comparison::GT, Opcode::IGtNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_ge(const Dinstruction &ins)
+    {
+        this->compare(Comparison::GE, Opcode::IGeNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_le(const Dinstruction &ins)
+    {
+        this->compare(Comparison::LE, Opcode::ILeNN);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_eq(const Dinstruction &ins)
+    {
+        this->push_bool(this->compare());
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_ne(const Dinstruction &ins)
+    {
+        this->push_bool(!this->compare());
+    }
+    template <typename RT>
+    bool Interpreter<RT>::compare()
+    {
+        LuaValue a = this->rt->stack_pop();
+        LuaValue b = this->rt->stack_pop();
+        return a == b;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tget(const Dinstruction &ins)
+    {
+        LuaValue k = this->rt->stack_pop();
+        LuaValue t = this->rt->stack_pop();
+        LuaValue v = this->rt->table_get(t, k);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+        this->rt->stack_push(v);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tset(const Dinstruction &ins)
+    {
+        LuaValue v = this->rt->stack_pop();
+        LuaValue k = this->rt->stack_pop();
+        LuaValue t = this->rt->stack_back_read(1);
+        this->rt->table_set(t, k, v);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tgetk(const Dinstruction &ins)
+    {
+        LuaValue t = this->rt->stack_pop();
+        LuaValue v = this->rt->field_get(t, this->rt->rodata(ins.a), ins.b);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+        this->rt->stack_push(v);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tsetk(const Dinstruction &ins)
+    {
+        LuaValue v = this->rt->stack_pop();
+        LuaValue t = this->rt->stack_back_read(1);
+        this->rt->field_set(t, this->rt->rodata(ins.a), v, ins.b);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_self(const Dinstruction &ins)
+    {
+        LuaValue obj = this->rt->stack_back_read(1);
+        LuaValue fn = this->rt->field_get(obj, this->rt->rodata(ins.a), ins.b);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+        this->rt->stack_back_write(2, fn);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tnew(const Dinstruction &ins)
+    {
+        this->rt->stack_push(this->rt->create_table(ins.a, ins.b));
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tclone(const Dinstruction &ins)
+    {
+        this->rt->stack_push(this->rt->clone_table(this->rt->rodata(ins.a)));
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tlist(const Dinstruction &ins)
+    {
+        size_t offset = ins.a;
+        size_t count = this->rt->extras();
+        LuaValue t = this->rt->stack_back_read(count + 1);
+        // the elements are set in ascending order so that they append to
+        // the array part of the table
+        for (size_t i = 0; i < count; i++)
+        {
+            LuaValue k = this->rt->create_integer(i + offset + 1);
+            LuaValue v = this->rt->stack_back_read(count - i);
+            this->rt->table_set(t, k, v);
+        }
+        for (size_t i = 0; i < count; i++)
+            this->rt->stack_pop();
+        this->rt->extras(0);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_gget(const Dinstruction &ins)
+    {
+        LuaValue k = this->rt->stack_pop();
+        LuaValue v = this->rt->global_get(k, ins.b);
+        this->rt->stack_push(v);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_gset(const Dinstruction &ins)
+    {
+        LuaValue v = this->rt->stack_pop();
+        LuaValue k = this->rt->stack_pop();
+        this->rt->global_set(k, v, ins.b);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_addnn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcAdd, Opcode::IAdd);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_subnn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcSub, Opcode::ISub);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_multnn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcMult, Opcode::IMult);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_flrdivnn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcFlrDiv, Opcode::IFlrDiv);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_fltdivnn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcFltDiv, Opcode::IFltDiv);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_modnn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcMod, Opcode::IMod);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_pownn(const Dinstruction &ins)
+    {
+        this->arith_nn(Calculation::CalcPow, Opcode::IPow);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_concatss(const Dinstruction &ins)
+    {
+        LuaValue b = this->rt->stack_back_read(1);
+        LuaValue a = this->rt->stack_back_read(2);
+        if (a.kind != LuaType::LVString || b.kind != LuaType::LVString)
+        {
+            this->quicken(Opcode::IConcat);
+            return this->i_concat(ins);
+        }
+        this->rt->stack_pop();
+        this->rt->stack_back_write(1, this->concat(a, b));
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_genn(const Dinstruction &ins)
+    {
+        this->compare_nn(Comparison::GE, Opcode::IGe);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_gtnn(const Dinstruction &ins)
+    {
+        this->compare_nn(Comparison::GT, Opcode::IGt);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_lenn(const Dinstruction &ins)
+    {
+        this->compare_nn(Comparison::LE, Opcode::ILe);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_ltnn(const Dinstruction &ins)
+    {
+        this->compare_nn(Comparison::LT, Opcode::ILt);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_ggetk(const Dinstruction &ins)
+    {
+        LuaValue v = this->rt->global_get(this->rt->rodata(ins.a), ins.b);
+        this->rt->stack_push(v);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_gsetk(const Dinstruction &ins)
+    {
+        LuaValue v = this->rt->stack_pop();
+        this->rt->global_set(this->rt->rodata(ins.a), v, ins.b);
+        if (this->rt->error_raised())
+            this->state = InterpreterState::Error;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_nil(const Dinstruction &ins)
+    {
+        this->rt->stack_push(this->rt->create_nil());
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_true(const Dinstruction &ins)
+    {
+        this->push_bool(true);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_false(const Dinstruction &ins)
+    {
+        this->push_bool(false);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_ret(const Dinstruction &ins)
+    {
+        this->retc = ins.a;
+        this->state = InterpreterState::End;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_call(const Dinstruction &ins)
+    {
+        this->rt->store_ip(this->ip);
+        this->argc = ins.a;
+        this->retc = ins.b;
+        this->state = InterpreterState::Call;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_tcall(const Dinstruction &ins)
+    {
+        this->rt->store_ip(this->ip);
+        this->argc = ins.a;
+        this->state = InterpreterState::Tail;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_vargs(const Dinstruction &ins)
+    {
+        size_t count = ins.a ? (ins.a - 1) : this->rt->argcount();
+        for (size_t i = 0; i < count; i++)
+            this->rt->stack_push(this->rt->arg(i));
+        if (ins.a == 0)
+            this->rt->extras(count);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_jmp(const Dinstruction &ins)
+    {
+        this->ip = ins.a;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_cjmp(const Dinstruction &ins)
+    {
+        LuaValue value = this->rt->stack_pop();
+        if (value.truth())
+            this->ip = ins.a;
+    }
+    template <typename RT>
+    template <typename N>
+    bool Interpreter<RT>::for_continue(N idx, N limit, N step)
+    {
+        return step > 0 ? idx <= limit : limit <= idx;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_forprep(const Dinstruction &ins)
+    {
+        // the control values are converted once here so that the loop
+        // step can work on raw numbers, the loop counts in integers only
+        // when all three of them are integers
+        LuaValue control[3];
+        bool ints = true;
+        for (size_t i = 0; i < 3; i++)
+        {
+            LuaValue v = this->rt->stack_back_read(3 - i);
+            LuaType t = v.kind;
+            if (t == LuaType::LVString)
+                v = this->parse_number(v);
+            if (v.kind != LuaType::LVNumber)
+                return this->generate_error(error_invalid_operand(t));
+            control[i] = v;
+            ints = ints && v.is_int();
+        }
+        for (size_t i = 0; i < 3; i++)
+        {
+            if (!ints)
+                control[i] = this->rt->create_number(control[i].number());
+            this->rt->stack_back_write(3 - i, control[i]);
+        }
+        bool run;
+        if (ints)
+        {
+            linteger idx = control[0].data.i, limit = control[1].data.i, step = control[2].data.i;
+            run = this->for_continue(idx, limit, step);
+        }
+        else
+            run = this->for_continue(control[0].number(), control[1].number(), control[2].number());
+        if (!run)
+            this->ip = ins.a;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_forloop(const Dinstruction &ins)
+    {
+        LuaValue idx = this->rt->stack_back_read(3);
+        LuaValue limit = this->rt->stack_back_read(2);
+        LuaValue step = this->rt->stack_back_read(1);
+        if (idx.is_int() && step.is_int())
+        {
+            linteger i, lim = limit.data.i, st = step.data.i;
+            // an overflowing index is past any limit
+            if (__builtin_add_overflow((linteger)idx.data.i, st, &i))
+                return;
+            this->rt->stack_back_write(3, this->rt->create_integer(i));
+            if (this->for_continue(i, lim, st))
+                this->ip = ins.a;
+            return;
+        }
+        // the block may have stored anything into the control variable
+        if (idx.kind == LuaType::LVNumber)
+            idx = this->rt->create_number(idx.number() + step.number());
+        else if (!this->arith(Calculation::CalcAdd, idx, step, idx))
+            return;
+        this->rt->stack_back_write(3, idx);
+        if (this->for_continue(idx.number(), limit.number(), step.number()))
+            this->ip = ins.a;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_fjmp(const Dinstruction &ins)
+    {
+        LuaValue value = this->rt->stack_pop();
+        if (!value.truth())
+            this->ip = ins.a;
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_andjmp(const Dinstruction &ins)
+    {
+        if (!this->rt->stack_back_read(1).truth())
+            this->ip = ins.a;
+        else
+            this->rt->stack_pop();
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_orjmp(const Dinstruction &ins)
+    {
+        if (this->rt->stack_back_read(1).truth())
+            this->ip = ins.a;
+        else
+            this->rt->stack_pop();
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_const(const Dinstruction &ins)
+    {
+        LuaValue val = this->rt->rodata(ins.a);
+        this->rt->stack_push(val);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_fconst(const Dinstruction &ins)
+    {
+        LuaValue fn = this->rt->create_luafn(ins.a);
+        this->rt->stack_push(fn);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_local(const Dinstruction &ins)
+    {
+        LuaValue value = this->rt->stack_read(ins.a);
+        this->rt->stack_push(value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_lstore(const Dinstruction &ins)
+    {
+        LuaValue value = this->rt->stack_pop();
+        this->rt->stack_write(ins.a, value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_blocal(const Dinstruction &ins)
+    {
+        LuaValue value = this->rt->stack_back_read(ins.a);
+        this->rt->stack_push(value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_blstore(const Dinstruction &ins)
+    {
+        LuaValue value = this->rt->stack_pop();
+        this->rt->stack_back_write(ins.a, value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_upvalue(const Dinstruction &ins)
+    {
+        Hook *hook = this->rt->upvalue(ins.a);
+        LuaValue value = this->hookread(hook);
+        this->rt->stack_push(value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_ustore(const Dinstruction &ins)
+    {
+        Hook *hook = this->rt->upvalue(ins.a);
+        LuaValue value = this->rt->stack_pop();
+        this->hookwrite(hook, value);
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_upush(const Dinstruction &ins)
+    {
+        this->rt->hookpush();
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_upop(const Dinstruction &ins)
+    {
+        this->rt->hookpop();
+    }
+    template <typename RT>
+    void Interpreter<RT>::i_pop(const Dinstruction &ins)
+    {
+        for (size_t i = 0; i < ins.a; i++)
+        {
+            this->rt->stack_pop();
+        }
+    }
+    template <typename RT>
+    void Interpreter<RT>::generate_error(Lerror error)
+    {
+        LuaValue errval = this->error_to_string(error);
+        if (this->config_error_metadata_v)
+            errval = this->error_add_meta(errval);
+        this->state = InterpreterState::Error;
+        this->rt->set_error(errval);
+        if (this->config_error_metadata_v)
+            this->rt->error_metadata(true);
+    }
+    template <typename RT>
+    LuaValue Interpreter<RT>::error_to_string(Lerror error)
+    {
+        if (error.kind == Lerror::LE_InvalidOperand)
+        {
+            LuaValue s1 = this->rt->create_string("invalid operation on type [");
+            LuaValue s2 = this->lua_type_to_string(error.as.invalid_operand.t);
+            LuaValue s3 = this->rt->create_string("]");
+            return this->concat(s1, this->concat(s2, s3));
+        }
+        else if (error.kind == Lerror::LE_InvalidComparison)
+        {
+            LuaValue s1 = this->rt->create_string("attemp to compare ");
+            LuaValue s2 = this->lua_type_to_string(error.as.invalid_comparison.t1);
+            LuaValue s3 = this->rt->create_string(" with ");
+            LuaValue s4 = this->lua_type_to_string(error.as.invalid_comparison.t2);
+            return this->concat(s1, this->concat(s2, this->concat(s3, s4)));
+        }
+        else if (error.kind == Lerror::LE_IntegerRepresentation)
+        {
+            return this->rt->create_string("number has no integer representation");
+        }
+        else
+        {
+            return this->rt->create_nil();
+        }
+    }
+
+    template <typename RT>
+    LuaValue Interpreter<RT>::concat(LuaValue s1, LuaValue s2)
+    {
+        return this->rt->create_string(s1.str(), s2.str());
+    }
+    template <typename RT>
+    LuaValue Interpreter<RT>::lua_type_to_string(LuaType t)
+    {
+        const char *texts[6] = {
+            [LVNil] = "nil",
+            [LVBool] = "boolean",
+            [LVNumber] = "number",
+            [LVString] = "string",
+            [LVTable] = "table",
+            [LVFunction] = "function",
+        };
+        return this->rt->create_string(texts[t]);
+    }
+    template <typename RT>
+    void Interpreter<RT>::config_error_metadata(bool val)
+    {
+        this->config_error_metadata_v = val;
+    }
+
+#undef INTERPRETER_OPTABLE
+#undef INTERPRETER_OPTABLE_CONTROL
+#undef INTERPRETER_OPTABLE_BRANCH
+#undef INTERPRETER_OPTABLE_ALLOC
+#undef INTERPRETER_THREADED
 };
 
 #endif
\ No newline at end of file
@@ -24,6 +24,20 @@ namespace luayed
     {
         bool load_stdlib = true;
         bool error_metadata = true;
+        // compile arithmetic and assignments on locals and constants to
+        // three-address register instructions instead of stack sequences
+        bool register_vm = false;
+        // fuse common instruction sequences into single instructions
+        bool superinstructions = true;
+        // collect garbage in small steps between instructions instead of
+        // stopping the program for whole collections
+        bool incremental_gc = false;
+        // collect the young objects often and the whole heap rarely,
+        // takes precedence over incremental_gc
+        bool generational_gc = false;
+        // threads that mark the heap in full collections, the parallel
+        // marking only starts for heaps of a few megabytes
+        size_t gc_threads = 1;
     };
 
     class Lua;
@@ -34,7 +48,8 @@ namespace luayed
     {
     private:
         LuaRuntime runtime;
-        Interpreter interpreter;
+        Interpreter<LuaRuntime> interpreter;
+        LuaConfig config;
 
     public:
         Lua(LuaConfig config = LuaConfig());
@@ -43,7 +58,11 @@ namespace luayed
         void push_string(const char *str);
         void push_nil();
         void push_number(lnumber num);
+        void push_integer(linteger num);
         void push_boolean(bool b);
+        // pushes a new table with room for narr sequence elements and nrec
+        // other fields
+        void create_table(size_t narr = 0, size_t nrec = 0);
         void insert(size_t index);
         void call(size_t arg_count, size_t return_count);
         int kind();
@@ -53,6 +72,10 @@ namespace luayed
         void pop();
         size_t top();
         lnumber pop_number();
+        // whether the number on top is an integer, pop_integer returns
+        // it without the rounding of pop_number
+        bool is_int();
+        linteger pop_integer();
         bool pop_boolean();
         const char *peek_string();
         void fetch_local(int idx);
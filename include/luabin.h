@@ -8,6 +8,9 @@ namespace luayed
 {
 
     size_t op_oprnd_count(lbyte op);
+    bool op_is_jump(lbyte op);
+    bool op_is_register(lbyte op);
+    bool op_has_cache(lbyte op);
 
     enum Opcode
     {
@@ -39,7 +42,6 @@ namespace luayed
 
         ITGet = 0x40,
         ITSet = 0x41,
-        ITNew = 0x42,
         IGGet = 0x43,
         IGSet = 0x44,
         INil = 0x45,
@@ -49,18 +51,87 @@ namespace luayed
         IUPush = 0x50,
         IUPop = 0x51,
 
+        // specialized forms the interpreter rewrites the generic instructions
+        // above into once it has seen their operand types. they only appear
+        // in decoded code and are never emitted by the compiler
+        IAddNN = 0x60,
+        ISubNN = 0x61,
+        IMultNN = 0x62,
+        IFlrDivNN = 0x63,
+        IFltDivNN = 0x64,
+        IModNN = 0x65,
+        IPowNN = 0x66,
+        IConcatSS = 0x67,
+        IGeNN = 0x72,
+        IGtNN = 0x73,
+        ILeNN = 0x74,
+        ILtNN = 0x75,
+
+        // register instructions, their operands are always 16 bits wide
+        IRAdd = 0x80,
+        IRSub = 0x81,
+        IRMult = 0x82,
+        IRFlrDiv = 0x83,
+        IRFltDiv = 0x84,
+        IRMod = 0x85,
+        IRPow = 0x86,
+        IRMove = 0x88,
+        // compare and jump to the first operand when the comparison holds,
+        // or in the negated forms when it does not
+        IRJEq = 0x90,
+        IRJNe = 0x91,
+        IRJLt = 0x92,
+        IRJLe = 0x93,
+        IRJGt = 0x94,
+        IRJGe = 0x95,
+        IRJNLt = 0x96,
+        IRJNLe = 0x97,
+        IRJNGt = 0x98,
+        IRJNGe = 0x99,
+        // quickened register arithmetic on two numbers, decoded code only
+        IRAddNN = 0xa0,
+        IRSubNN = 0xa1,
+        IRMultNN = 0xa2,
+        IRFlrDivNN = 0xa3,
+        IRFltDivNN = 0xa4,
+        IRModNN = 0xa5,
+        IRPowNN = 0xa6,
+
         ITList = 0xc0,
         IRet = 0xc2,
+        ITGetK = 0xc4,
+        ITSetK = 0xc6,
+        ISelf = 0xc8,
+        IGGetK = 0xca,
+        IGSetK = 0xcc,
+        // pushes a copy of the constant table template its operand points
+        // to, for constructors whose fields are all literals
+        ITClone = 0xce,
 
         ICall = 0xd0,
         IVargs = 0xd4,
         IJmp = 0xd6,
         ICjmp = 0xd8,
         ITCall = 0xda,
+        // numeric for control over the index, limit and step on top of
+        // the stack. both jump to the first operand
+        IForPrep = 0xdc,
+        IForLoop = 0xde,
 
         IConst = 0xe0,
         IFConst = 0xe2,
 
+        // jump when the popped value is false
+        IFjmp = 0xe4,
+        // short circuits of and/or, they jump keeping the value on the
+        // stack when it is false/true and pop it otherwise
+        IAndJmp = 0xe6,
+        IOrJmp = 0xe8,
+
+        // new table presized for the array and hash counts of its
+        // constructor
+        ITNew = 0xec,
+
         ILocal = 0xf0,
         ILStore = 0xf2,
         IBLocal = 0xf4,
@@ -84,7 +155,7 @@ namespace luayed
     struct Bytecode
     {
         lbyte count;
-        lbyte bytes[5];
+        lbyte bytes[7];
     };
 
     struct Instruction
@@ -92,18 +163,41 @@ namespace luayed
         Opcode op;
         size_t oprnd1;
         size_t oprnd2;
+        size_t oprnd3;
         dbginfo_t dbg;
 
-        Instruction(Opcode op, size_t oprnd1 = 0, size_t oprnd2 = 0);
+        Instruction(Opcode op, size_t oprnd1 = 0, size_t oprnd2 = 0, size_t oprnd3 = 0);
 
         size_t oprnd_count() const;
         Bytecode encode() const;
         static Instruction decode(Bytecode code);
         static Instruction decode(const lbyte *binary, size_t *read_count = nullptr);
     };
+    // fixed-width form of an instruction, executed by the interpreter.
+    // jump targets are indices into the decoded array. instructions
+    // owning an inline cache hold the index of their slot in b.
+    struct Dinstruction
+    {
+        uint32_t op;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+    };
+
+    // decodes the compact text into fixed-width instructions and returns
+    // their count. textpos receives the text offset of each instruction
+    // and cachelen the number of inline cache slots used.
+    // when code is null, only the counts are computed.
+    size_t predecode(const lbyte *text, size_t codelen, Dinstruction *code = nullptr, uint32_t *textpos = nullptr, size_t *cachelen = nullptr);
+
     bool operator==(const Upvalue &l, const Upvalue &r);
 };
 
+// source and destination operands of register instructions address a local
+// slot, a constant when REG_CONST is set, or the top of the value stack
+#define REG_CONST 0x8000
+#define REG_STACK 0xffff
+
 #define iadd IAdd
 #define isub ISub
 #define imult IMult
@@ -129,7 +223,6 @@ namespace luayed
 #define ilt ILt
 #define itget ITGet
 #define itset ITSet
-#define itnew ITNew
 #define igget IGGet
 #define igset IGSet
 #define inil INil
@@ -140,10 +233,16 @@ namespace luayed
 #define itlist(A) Instruction(ITList, A)
 #define iret(A) Instruction(IRet, A)
 #define icall(A, B) Instruction(ICall, A, B)
+#define itnew(A, B) Instruction(ITNew, A, B)
 #define ivargs(A) Instruction(IVargs, A)
 #define itcall(A) Instruction(ITCall, A)
 #define ijmp(A) Instruction(IJmp, A)
 #define icjmp(A) Instruction(ICjmp, A)
+#define ifjmp(A) Instruction(IFjmp, A)
+#define iandjmp(A) Instruction(IAndJmp, A)
+#define iorjmp(A) Instruction(IOrJmp, A)
+#define iforprep(A) Instruction(IForPrep, A)
+#define iforloop(A) Instruction(IForLoop, A)
 #define iconst(A) Instruction(IConst, A)
 #define ifconst(A) Instruction(IFConst, A)
 #define ilocal(A) Instruction(ILocal, A)
@@ -153,5 +252,29 @@ namespace luayed
 #define iupvalue(A) Instruction(IUpvalue, A)
 #define iustore(A) Instruction(IUStore, A)
 #define ipop(A) Instruction(IPop, A)
+#define iradd(A, B, C) Instruction(IRAdd, A, B, C)
+#define irsub(A, B, C) Instruction(IRSub, A, B, C)
+#define irmult(A, B, C) Instruction(IRMult, A, B, C)
+#define irflrdiv(A, B, C) Instruction(IRFlrDiv, A, B, C)
+#define irfltdiv(A, B, C) Instruction(IRFltDiv, A, B, C)
+#define irmod(A, B, C) Instruction(IRMod, A, B, C)
+#define irpow(A, B, C) Instruction(IRPow, A, B, C)
+#define irmove(A, B) Instruction(IRMove, A, B)
+#define irjeq(A, B, C) Instruction(IRJEq, A, B, C)
+#define irjne(A, B, C) Instruction(IRJNe, A, B, C)
+#define irjlt(A, B, C) Instruction(IRJLt, A, B, C)
+#define irjle(A, B, C) Instruction(IRJLe, A, B, C)
+#define irjgt(A, B, C) Instruction(IRJGt, A, B, C)
+#define irjge(A, B, C) Instruction(IRJGe, A, B, C)
+#define irjnlt(A, B, C) Instruction(IRJNLt, A, B, C)
+#define irjnle(A, B, C) Instruction(IRJNLe, A, B, C)
+#define irjngt(A, B, C) Instruction(IRJNGt, A, B, C)
+#define irjnge(A, B, C) Instruction(IRJNGe, A, B, C)
+#define itgetk(A) Instruction(ITGetK, A)
+#define itsetk(A) Instruction(ITSetK, A)
+#define iself(A) Instruction(ISelf, A)
+#define iggetk(A) Instruction(IGGetK, A)
+#define igsetk(A) Instruction(IGSetK, A)
+#define itclone(A) Instruction(ITClone, A)
 
 #endif
\ No newline at end of file
@@ -5,8 +5,17 @@
 #include <string>
 #include <iostream>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 
-#define is_obj(V) ((V).kind > 2)
+#ifdef LUAYED_NAN_BOXING
+// values at or above the string tag are references to collected objects,
+// short strings excepted
+#define is_obj(V) ((V).bits >= NANBOX_TAG(LuaType::LVString) && !((V).bits & SSTR_FLAG))
+#else
+#define is_obj(V) ((V).kind > 2 && !((uint64_t)(V).data.i & SSTR_FLAG))
+#endif
 
 typedef std::string string;
 
@@ -18,6 +27,7 @@ extern std::ostream &dbg;
 namespace luayed
 {
     typedef double lnumber;
+    typedef int64_t linteger;
 
     typedef unsigned char lbyte;
     typedef size_t fidx_t;
@@ -32,30 +42,265 @@ namespace luayed
         LVFunction = 5,
     };
 
+#ifdef LUAYED_NAN_BOXING
+
+    // A NaN-boxed value is a single 64 bit word. Floats are stored as plain
+    // doubles (NaNs are canonicalized on write) and every other kind lives in
+    // the 48 bit payload of a negative quiet NaN whose top 16 bits are
+    // NANBOX_BASE + kind. Integers that fit in 48 bits use the otherwise free
+    // number tag, wider ones are boxed on the heap under NANBOX_BIGINT, so
+    // integers are 64 bits wide like in the unboxed layout. kind and data are
+    // views over that word, so values are read and written with the same
+    // syntax as the unboxed layout.
+    typedef uint64_t lvbits_t;
+
+#define NANBOX_BASE 0xfff9
+#define NANBOX_PAYLOAD 0x0000ffffffffffffull
+#define NANBOX_NAN 0x7ff8000000000000ull
+#define NANBOX_TAG(K) ((lvbits_t)(NANBOX_BASE + (K)) << 48)
+#define NANBOX_INT_BITS 48
+// top 16 bits of an integer boxed on the heap, its kind is a number
+#define NANBOX_BIGINT 0xffff
+// short strings set the top payload bit, which no user space pointer has,
+// and keep their bytes and terminator in the bytes below
+#define SSTR_FLAG (1ull << 47)
+#define SSTR_MAX_LEN 4
+
+    struct LuaValueKind
+    {
+        lvbits_t bits;
+
+        operator LuaType() const
+        {
+            lvbits_t tag = this->bits >> 48;
+            return tag >= NANBOX_BASE && tag != NANBOX_BIGINT ? (LuaType)(tag - NANBOX_BASE) : LuaType::LVNumber;
+        }
+        LuaValueKind &operator=(LuaType kind)
+        {
+            if ((LuaType)(*this) == kind)
+                return *this;
+            this->bits = kind == LuaType::LVNumber ? 0 : NANBOX_TAG(kind);
+            return *this;
+        }
+    };
+
+    struct LuaValueNumber
+    {
+        lvbits_t bits;
+
+        operator lnumber() const
+        {
+            lnumber n;
+            memcpy(&n, &this->bits, sizeof(n));
+            return n;
+        }
+        LuaValueNumber &operator=(lnumber n)
+        {
+            if (n != n)
+                this->bits = NANBOX_NAN;
+            else
+                memcpy(&this->bits, &n, sizeof(n));
+            return *this;
+        }
+    };
+
+    struct LuaValueInteger
+    {
+        lvbits_t bits;
+
+        operator linteger() const
+        {
+            if ((this->bits >> 48) == NANBOX_BIGINT)
+                return *(const linteger *)(uintptr_t)(this->bits & NANBOX_PAYLOAD);
+            return (linteger)(this->bits << (64 - NANBOX_INT_BITS)) >> (64 - NANBOX_INT_BITS);
+        }
+    };
+
+    struct LuaValueBool
+    {
+        lvbits_t bits;
+
+        operator bool() const
+        {
+            return this->bits & 1;
+        }
+        LuaValueBool &operator=(bool b)
+        {
+            this->bits = NANBOX_TAG(LuaType::LVBool) | b;
+            return *this;
+        }
+    };
+
+    struct LuaValuePointer
+    {
+        lvbits_t bits;
+
+        template <typename T>
+        operator T *() const
+        {
+            return (T *)(uintptr_t)(this->bits & NANBOX_PAYLOAD);
+        }
+        explicit operator uintptr_t() const
+        {
+            return this->bits & NANBOX_PAYLOAD;
+        }
+        LuaValuePointer &operator=(void *ptr)
+        {
+            this->bits = (this->bits & ~NANBOX_PAYLOAD) | (uintptr_t)ptr;
+            return *this;
+        }
+    };
+
+    class LuaValue
+    {
+    public:
+        union
+        {
+            lvbits_t bits;
+            LuaValueKind kind;
+            union
+            {
+                LuaValueNumber n;
+                LuaValueInteger i;
+                LuaValueBool b;
+                LuaValuePointer ptr;
+            } data;
+        };
+
+        LuaValue()
+        {
+            this->bits = NANBOX_TAG(LuaType::LVNil);
+        }
+
+        bool truth()
+        {
+            return this->bits != NANBOX_TAG(LuaType::LVNil) && this->bits != NANBOX_TAG(LuaType::LVBool);
+        }
+        bool is_int() const
+        {
+            lvbits_t tag = this->bits >> 48;
+            return tag == NANBOX_BASE + LuaType::LVNumber || tag == NANBOX_BIGINT;
+        }
+        lnumber number() const
+        {
+            return this->is_int() ? (lnumber)this->data.i : (lnumber)this->data.n;
+        }
+        static bool fits_int(linteger i)
+        {
+            return i == (linteger)((lvbits_t)i << (64 - NANBOX_INT_BITS)) >> (64 - NANBOX_INT_BITS);
+        }
+        // i fits in the payload, LuaRuntime::create_integer boxes the others
+        void set_int(linteger i)
+        {
+            this->bits = NANBOX_TAG(LuaType::LVNumber) | ((lvbits_t)i & NANBOX_PAYLOAD);
+        }
+        // box points to the integer, which is a collected object
+        void set_boxed_int(linteger *box)
+        {
+            this->bits = ((lvbits_t)NANBOX_BIGINT << 48) | (uintptr_t)box;
+        }
+        template <typename T>
+        T as() const
+        {
+            return ((T)(uintptr_t)(this->bits & NANBOX_PAYLOAD));
+        }
+        bool is_sstr() const
+        {
+            return (this->bits >> 47) == ((NANBOX_TAG(LuaType::LVString) | SSTR_FLAG) >> 47);
+        }
+        void set_sstr(const char *s, size_t len)
+        {
+            lvbits_t chars = 0;
+            memcpy(&chars, s, len);
+            this->bits = NANBOX_TAG(LuaType::LVString) | SSTR_FLAG | chars;
+        }
+        // short strings point into the value itself
+        const char *str() const
+        {
+            return this->is_sstr() ? (const char *)&this->bits : this->as<const char *>();
+        }
+    };
+
+    static_assert(sizeof(void *) == 8 && sizeof(LuaValue) == 8,
+                  "NaN boxing needs 64 bit pointers");
+
+#else
+
+// short strings set the top bit of the data word, which no user space
+// pointer has, and keep their bytes and terminator in the bytes below
+#define SSTR_FLAG (1ull << 63)
+#define SSTR_MAX_LEN 6
+
     class LuaValue
     {
     public:
         LuaType kind;
+        bool isint = false;
         union
         {
             bool b;
             lnumber n;
+            linteger i;
             void *ptr;
         } data;
 
-        LuaValue();
+        LuaValue()
+        {
+            this->kind = LuaType::LVNil;
+        }
 
         bool truth()
         {
             return this->kind != LuaType::LVNil && (this->kind != LuaType::LVBool || this->data.b);
         }
+        bool is_int() const
+        {
+            return this->kind == LuaType::LVNumber && this->isint;
+        }
+        lnumber number() const
+        {
+            return this->isint ? (lnumber)this->data.i : this->data.n;
+        }
+        // every integer fits, nothing is ever boxed
+        static bool fits_int(linteger)
+        {
+            return true;
+        }
+        void set_int(linteger i)
+        {
+            this->kind = LuaType::LVNumber;
+            this->isint = true;
+            this->data.i = i;
+        }
         template <typename T>
         T as() const
         {
             return ((T)this->data.ptr);
         }
+        bool is_sstr() const
+        {
+            return this->kind == LuaType::LVString && ((uint64_t)this->data.i & SSTR_FLAG);
+        }
+        void set_sstr(const char *s, size_t len)
+        {
+            uint64_t chars = 0;
+            memcpy(&chars, s, len);
+            this->kind = LuaType::LVString;
+            this->isint = false;
+            this->data.i = (linteger)(chars | SSTR_FLAG);
+        }
+        // short strings point into the value itself
+        const char *str() const
+        {
+            return this->is_sstr() ? (const char *)&this->data : (const char *)this->data.ptr;
+        }
     };
 
+#endif
+
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+                  "short strings keep their first byte in the low byte of a word");
+
     struct Hook
     {
         bool is_detached;
@@ -80,8 +325,39 @@ namespace luayed
 
     void crash(string message);
 
-    bool operator==(const LuaValue &v1, const LuaValue &v2);
-    bool operator!=(const LuaValue &v1, const LuaValue &v2);
+    // converts floats that hold an exact 64 bit integer value
+    inline bool number_to_int(lnumber n, linteger *i)
+    {
+        if (!(n >= -9223372036854775808.0 && n < 9223372036854775808.0) || floor(n) != n)
+            return false;
+        *i = (linteger)n;
+        return true;
+    }
+
+    // inline so the hash set equality functors compile down to it
+    inline bool operator==(const LuaValue &v1, const LuaValue &v2)
+    {
+#ifdef LUAYED_NAN_BOXING
+        if (v1.kind == LuaType::LVNumber && v2.kind == LuaType::LVNumber)
+            return v1.is_int() && v2.is_int() ? v1.data.i == v2.data.i : v1.number() == v2.number();
+        return v1.bits == v2.bits;
+#else
+        if (v1.kind != v2.kind)
+            return false;
+        if (v1.kind == LuaType::LVNil)
+            return true;
+        else if (v1.kind == LuaType::LVNumber)
+            return v1.is_int() && v2.is_int() ? v1.data.i == v2.data.i : v1.number() == v2.number();
+        else if (v1.kind == LuaType::LVBool)
+            return v1.data.b == v2.data.b;
+        else
+            return v1.data.ptr == v2.data.ptr;
+#endif
+    }
+    inline bool operator!=(const LuaValue &v1, const LuaValue &v2)
+    {
+        return !(v1 == v2);
+    }
 
 };
 
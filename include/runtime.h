@@ -18,30 +18,76 @@ namespace luayed
     typedef size_t (*LuaRTCppFunction)(void *);
     struct LuaFunction;
     struct gc_header_t;
+    struct TableElement;
+    class Shape;
+    class GarbageCollector;
+    class Arena;
+    struct ArenaStats;
 
-    enum AllocType
+    enum AllocType : uint8_t
     {
         ATHook,
         ATString,
         ATTable,
         ATFunction,
         ATBinary,
-        ATDummy,
+        // integers too wide for a NaN-boxed value
+        ATInteger,
     };
 
-    struct gc_header_t
+    // The word in front of every heap object. size_class is the slot size
+    // of the arena in granules, 0 for objects allocated with malloc. The
+    // mark bits of the ones in the arena are in the bitmaps of its pages.
+    struct alignas(8) gc_header_t
     {
-        gc_header_t *next;
-        gc_header_t *prev;
-        gc_header_t *scan;
-        bool marked;
         AllocType alloc_type;
+        uint8_t size_class;
+        // minor collections survived, objects of GC_PROMOTE_AGE are old
+        uint8_t age;
+        // an old object in the remembered set of the generational mode
+        bool remembered;
+        // objects allocated with malloc only
+        bool marked;
+    };
+    // in front of the header of objects allocated with malloc, the sweep
+    // finds them in this list
+    struct large_header_t
+    {
+        large_header_t *next;
+        large_header_t *prev;
+    };
+
+    // inline cache of a global access, slot points into the global table
+    // and is valid for key while the table's version matches
+    struct GlobalCache
+    {
+        const void *key;
+        size_t version;
+        TableElement *slot;
+    };
+    // inline cache of a field access with a constant key, tables of shape
+    // keep the field's value at index of their field slots. when next is
+    // set the key is missing from shape, storing it there moves the table
+    // to next
+    struct FieldCache
+    {
+        Shape *shape;
+        size_t index;
+        Shape *next;
+    };
+    // a site is either a global or a field access, its opcode tells which
+    union InlineCache
+    {
+        GlobalCache global;
+        FieldCache field;
     };
 
     class Lfunction
     {
     public:
         size_t codelen = 0;
+        size_t oplen = 0;
+        size_t iclen = 0;
         size_t uplen = 0;
         size_t rolen = 0;
         size_t inlen = 0;
@@ -52,6 +98,9 @@ namespace luayed
         LuaValue chunkname;
 
         lbyte *text();
+        Dinstruction *code();
+        InlineCache *icache();
+        uint32_t *textpos();
         Upvalue *ups();
         LuaValue *rodata();
         Lfunction **innerfns();
@@ -82,17 +131,33 @@ namespace luayed
         size_t vargs_count;
         // number of values returned to this function after an expect-free call
         size_t ret_count;
+        // cached by bind() so that stack and constant accesses skip the
+        // function object; bin is null for native and empty frames
+        LuaValue *base;
+        LuaValue *consts;
+        Lfunction *lbin;
+        // slots below are addressed directly, the rest are shifted past
+        // the varargs. all slots of native frames are direct.
+        size_t direct;
 
+        void bind(LuaValue fn);
         bool is_Lua();
         Lfunction *bin();
         size_t parcount();
         size_t hookmax();
-        LuaValue *stack();
         LuaValue *vargs();
         size_t vargcount();
         Hook **uptable();
         Hook **hooktable();
-        size_t stack_address(size_t idx);
+
+        LuaValue *stack()
+        {
+            return this->base;
+        }
+        size_t stack_address(size_t idx)
+        {
+            return idx < this->direct ? idx : (idx + this->vargs_count);
+        }
     };
     struct GenFunction
     {
@@ -112,7 +177,7 @@ namespace luayed
         hash_t hash;
         size_t len;
 
-        const char *cstr()
+        const char *cstr() const
         {
             return (const char *)(this + 1);
         }
@@ -120,13 +185,31 @@ namespace luayed
 
     typedef lstr_t *lstr_p;
 
-    class LuaRuntime : public IRuntime, public IAllocator
+    struct LstrHash
+    {
+        hash_t operator()(const lstr_p &s) const
+        {
+            return s->hash;
+        }
+    };
+    struct LstrEq
+    {
+        bool operator()(const lstr_p &a, const lstr_p &b) const
+        {
+            return a == b || (a->hash == b->hash && a->len == b->len && memcmp(a->cstr(), b->cstr(), a->len) == 0);
+        }
+    };
+
+    class LuaRuntime final : public IRuntime, public IAllocator
     {
     private:
         size_t allocated = 0;
         size_t threshold = 1024;
+        // a full collection in generational mode once allocated passes it
+        size_t major_threshold = 0;
 
-        Set<lstr_p> lstrset;
+        Set<lstr_p, LstrHash, LstrEq> lstrset;
+        hash_t seed;
         Frame *frame;
         void *stack_buffer;
         IInterpreter *interpreter;
@@ -134,12 +217,22 @@ namespace luayed
         void *lua_interface = nullptr;
         LuaValue global;
         bool test_mode = false;
-        gc_header_t *heap_head;
-        gc_header_t *heap_tail;
+        large_header_t *large = nullptr;
         Lfunction *compiled_bin;
+        Shape *shapes;
+        GarbageCollector *gc;
+        Arena *arena;
+        // set while an incremental collection is marking, the stores into
+        // heap objects have to shade what they store
+        bool marking = false;
+        bool incremental = false;
+        bool generational = false;
+        // threads marking the heap in full collections
+        size_t gc_threads = 1;
 
         void new_frame();
         void collect_garbage();
+        void run_garbage_collection();
         void copy_values(Frame *fsrc, Frame *fdest, size_t count, size_t offset);
         void push_nils(Frame *fsrc, size_t count);
         LuaValue concat(LuaValue v1, LuaValue v2);
@@ -155,10 +248,14 @@ namespace luayed
         void *allocate_raw(size_t size);
         void *allocate(size_t size, AllocType at);
         void deallocate_raw(void *ptr);
-        void heap_init();
-        void heap_destroy();
-        void heap_insert(gc_header_t *node, gc_header_t *prev, gc_header_t *next);
-        void heap_remove(gc_header_t *node);
+        void large_insert(large_header_t *node);
+        void large_remove(large_header_t *node);
+        void barrier(void *obj, LuaValue v);
+#ifdef LUAYED_NAN_BOXING
+        LuaValue create_boxed_integer(linteger n);
+#endif
+
+        friend class GarbageCollector;
 
     public:
         LuaRuntime(IInterpreter *interpreter);
@@ -168,11 +265,29 @@ namespace luayed
 
         LuaValue create_nil();
         LuaValue create_boolean(bool b);
-        LuaValue create_number(lnumber n);
+        LuaValue create_number(lnumber n)
+        {
+            LuaValue val;
+            val.kind = LuaType::LVNumber;
+            val.data.n = n;
+            return val;
+        }
+        LuaValue create_integer(linteger n)
+        {
+            LuaValue val;
+#ifdef LUAYED_NAN_BOXING
+            if (!LuaValue::fits_int(n))
+                return this->create_boxed_integer(n);
+#endif
+            val.set_int(n);
+            return val;
+        }
         LuaValue create_string(const char *s);
         LuaValue create_string(lnumber n);
+        LuaValue create_string(linteger n);
         LuaValue create_string(const char *s1, const char *s2);
-        LuaValue create_table();
+        LuaValue create_table(size_t narr = 0, size_t nrec = 0);
+        LuaValue clone_table(LuaValue t);
         Lfunction *create_binary(GenFunction *gfn);
         LuaValue create_cppfn(LuaRTCppFunction fn);
         LuaValue create_luafn(fidx_t fidx);
@@ -181,7 +296,12 @@ namespace luayed
 
         void table_set(LuaValue t, LuaValue k, LuaValue v);
         LuaValue table_get(LuaValue t, LuaValue k);
+        size_t table_length(LuaValue t);
         LuaValue table_global();
+        LuaValue global_get(LuaValue k, size_t ic);
+        void global_set(LuaValue k, LuaValue v, size_t ic);
+        LuaValue field_get(LuaValue t, LuaValue k, size_t ic);
+        void field_set(LuaValue t, LuaValue k, LuaValue v, size_t ic);
         bool table_check(LuaValue t, LuaValue k, bool is_set);
 
         Fnresult fncall(size_t argc, size_t retc, bool is_tail);
@@ -199,29 +319,84 @@ namespace luayed
         void store_ip(size_t ip);
         size_t load_ip();
 
-        LuaValue stack_pop();
-        void stack_push(LuaValue value);
-        LuaValue stack_read(size_t idx);
-        void stack_write(size_t idx, LuaValue value);
-        LuaValue stack_back_read(size_t idx);
-        void stack_back_write(size_t idx, LuaValue value);
+        // the accessors below are on the interpreter's hot path, they are
+        // defined inline so that Interpreter<LuaRuntime> can expand them
+        LuaValue stack_pop()
+        {
+            return this->frame->base[--this->frame->sp];
+        }
+        void stack_push(LuaValue value)
+        {
+            this->frame->base[this->frame->sp++] = value;
+        }
+        LuaValue stack_read(size_t idx)
+        {
+            return this->frame->base[this->frame->stack_address(idx)];
+        }
+        void stack_write(size_t idx, LuaValue value)
+        {
+            this->frame->base[this->frame->stack_address(idx)] = value;
+        }
+        LuaValue stack_back_read(size_t idx)
+        {
+            return this->frame->base[this->frame->sp - idx];
+        }
+        // valid while the value stays on the stack, a short string lives
+        // in the stack slot
+        const char *stack_back_string(size_t idx)
+        {
+            return this->frame->base[this->frame->sp - idx].str();
+        }
+        void stack_back_write(size_t idx, LuaValue value)
+        {
+            this->frame->base[this->frame->sp - idx] = value;
+        }
+        LuaValue rodata(size_t idx)
+        {
+            return this->frame->consts[idx];
+        }
+        size_t stack_size()
+        {
+            return this->frame->sp;
+        }
         void hookpush();
         void hookpop();
         LuaValue arg(size_t idx);
         Hook *upvalue(size_t idx);
-        LuaValue rodata(size_t idx);
         lbyte *text();
+        Dinstruction *code();
+        uint32_t *textpos();
         dbginfo_t *dbgmd();
-        size_t stack_size();
         size_t argcount();
         size_t extras();
         void extras(size_t count);
         LuaValue chunkname();
-        void check_garbage_collection();
-        size_t length(const char *str);
+        // polled by the interpreter at its safepoints
+        void check_garbage_collection()
+        {
+            if (this->allocated > this->threshold)
+                this->run_garbage_collection();
+        }
+        size_t length(LuaValue s);
+        // obj is about to store v
+        void write_barrier(void *obj, LuaValue v)
+        {
+            if ((this->marking || this->generational) && is_obj(v))
+                this->barrier(obj, v);
+        }
+        // collect in steps interleaved with the mutator instead of all at once
+        void set_incremental_gc(bool incremental);
+        // collect the young objects often and the whole heap rarely, takes
+        // precedence over the incremental mode
+        void set_generational_gc(bool generational);
+        // mark large heaps with this many threads, 0 and 1 mark on the
+        // calling thread only
+        void set_gc_threads(size_t threads);
 
         Frame *topframe();
-        gc_header_t *gc_headers();
+        Shape *shape_root();
+        GarbageCollector *collector();
+        ArenaStats arena_stats();
     };
 
     struct LuaFunction
@@ -2,177 +2,292 @@
 #define SET_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include "virtuals.h"
 
-#define SET_FLAG_EMPTY 0
-#define SET_FLAG_FULL 1
-#define SET_FLAG_DEAD 2
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SET_GROUP_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SET_GROUP_WIDTH 16
+#else
+#define SET_GROUP_WIDTH 8
+#endif
 
-#define SET_LOAD_FACTOR 0.75f
+#define SET_CTRL_EMPTY ((int8_t)0x80)
+#define SET_CTRL_DEAD ((int8_t)0xfe)
+
+// live and dead slots together may fill 7/8 of the capacity
+#define SET_MAX_LOAD(CAP) ((CAP) - (CAP) / 8)
 #define SET_GROWTH_RATE 2
+#define SET_MIN_CAPACITY SET_GROUP_WIDTH
 
 namespace luayed
 {
 
     typedef size_t hash_t;
 
-    template <typename T>
-    using key_compare = int (*)(const T &a, const T &b);
+    // A group of control bytes matched at once. Each match returns a mask
+    // with one bit per slot of the group.
+    struct SetGroup
+    {
+#if SET_GROUP_WIDTH == 32
+        __m256i ctrl;
 
-    template <typename T>
-    using key_hash = hash_t (*)(const T &a);
+        SetGroup(const int8_t *ctrl) : ctrl(_mm256_loadu_si256((const __m256i *)ctrl))
+        {
+        }
+        uint32_t match(int8_t h2) const
+        {
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(this->ctrl, _mm256_set1_epi8(h2)));
+        }
+        uint32_t match_empty() const
+        {
+            return this->match(SET_CTRL_EMPTY);
+        }
+        uint32_t match_free() const
+        {
+            return _mm256_movemask_epi8(this->ctrl);
+        }
+#elif SET_GROUP_WIDTH == 16
+        __m128i ctrl;
 
-    template <typename T>
-    struct Bucket
-    {
-        T val;
-        unsigned char flag;
+        SetGroup(const int8_t *ctrl) : ctrl(_mm_loadu_si128((const __m128i *)ctrl))
+        {
+        }
+        uint32_t match(int8_t h2) const
+        {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(this->ctrl, _mm_set1_epi8(h2)));
+        }
+        uint32_t match_empty() const
+        {
+            return this->match(SET_CTRL_EMPTY);
+        }
+        uint32_t match_free() const
+        {
+            return _mm_movemask_epi8(this->ctrl);
+        }
+#else
+        uint64_t ctrl;
+
+        SetGroup(const int8_t *ctrl)
+        {
+            memcpy(&this->ctrl, ctrl, sizeof(this->ctrl));
+        }
+        // gathers the top bit of every byte into the low byte
+        static uint32_t pack(uint64_t bytes)
+        {
+            return ((bytes >> 7) * 0x0102040810204080ull) >> 56;
+        }
+        // may report false positives after a real match, which the
+        // element comparison filters out
+        uint32_t match(int8_t h2) const
+        {
+            uint64_t x = this->ctrl ^ (0x0101010101010101ull * (uint8_t)h2);
+            return pack((x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull);
+        }
+        // exact, unlike match: only empty bytes have the top bit set and
+        // bit 1 clear
+        uint32_t match_empty() const
+        {
+            return pack(this->ctrl & ~(this->ctrl << 6) & 0x8080808080808080ull);
+        }
+        uint32_t match_free() const
+        {
+            return pack(this->ctrl & 0x8080808080808080ull);
+        }
+#endif
     };
 
-    template <typename T>
+    // Open addressing set in the style of a swiss table. Every slot has a
+    // control byte in a separate array: empty, dead or the low 7 bits of the
+    // element's hash. Lookups match a whole group of control bytes against
+    // the hash fragment and only compare the elements that matched. Groups
+    // are probed in triangular steps and the capacity is a power of two, so
+    // every group is visited. H and E are the hash and equality functors. The
+    // control fragment is the low 7 bits of the hash and the group comes
+    // from the bits above, so H has to spread its input over the whole word.
+    template <typename T, typename H, typename E>
     class Set
     {
     private:
-        key_compare<T> comp;
-        key_hash<T> hash;
         IAllocator *allocator;
         size_t cap;
         size_t count;
-        Bucket<T> *buffer;
+        size_t used;
+        size_t removed;
+        size_t layout;
+        int8_t *ctrl;
+        T *slots;
 
-        size_t next_idx(size_t idx) const
+        size_t first_group(hash_t h) const
         {
-            return (idx + 1) % this->cap;
+            return (h >> 7) & (this->cap / SET_GROUP_WIDTH - 1);
         }
-
-        Bucket<T> *next(Bucket<T> *b)
+        size_t next_group(size_t g, size_t step) const
         {
-            if (b == this->buffer + (this->cap - 1))
-                b = this->buffer;
-            else
-                b = b + 1;
-            return b;
+            return (g + step) & (this->cap / SET_GROUP_WIDTH - 1);
         }
 
-        Bucket<T> *prev(Bucket<T> *b)
+        T *search(const T &ele, hash_t h) const
         {
-            if (b == this->buffer)
-                b = this->buffer + this->cap - 1;
-            else
-                b = b - 1;
-            return b;
-        }
-
-        Bucket<T> *search(const T &ele) const
-        {
-            Bucket<T> *dead = nullptr;
-            hash_t h = this->hash(ele) % this->cap, i = h;
-            while (this->buffer[i].flag != SET_FLAG_EMPTY)
+            int8_t h2 = h & 0x7f;
+            size_t g = this->first_group(h);
+            for (size_t step = 1;; step++)
             {
-                if (this->buffer[i].flag == SET_FLAG_DEAD)
+                size_t base = g * SET_GROUP_WIDTH;
+                SetGroup group(this->ctrl + base);
+                for (uint32_t m = group.match(h2); m; m &= m - 1)
                 {
-                    if (!dead)
-                        dead = this->buffer + i;
+                    T *slot = this->slots + base + __builtin_ctz(m);
+                    if (E()(*slot, ele))
+                        return slot;
                 }
-                else if (this->comp(this->buffer[i].val, ele) == 0)
-                {
-                    return this->buffer + i;
-                }
-                i = this->next_idx(i);
+                if (group.match_empty())
+                    return nullptr;
+                g = this->next_group(g, step);
+            }
+        }
+        size_t search_free(hash_t h) const
+        {
+            size_t g = this->first_group(h);
+            for (size_t step = 1;; step++)
+            {
+                uint32_t m = SetGroup(this->ctrl + g * SET_GROUP_WIDTH).match_free();
+                if (m)
+                    return g * SET_GROUP_WIDTH + __builtin_ctz(m);
+                g = this->next_group(g, step);
             }
-            if (dead)
-                return dead;
-            return this->buffer + i;
         }
-        double calc_load()
+        void place(size_t idx, hash_t h, const T &ele)
         {
-            return ((double)this->count) / ((double)this->cap);
+            if (this->ctrl[idx] == SET_CTRL_EMPTY)
+                this->used++;
+            this->ctrl[idx] = h & 0x7f;
+            this->slots[idx] = ele;
+            this->count++;
         }
-        Bucket<T> *allocate(size_t size)
+        void allocate(size_t cap)
         {
-            Bucket<T> *buf = (Bucket<T> *)this->allocator->allocate_raw(sizeof(Bucket<T>) * size);
-            for (size_t i = 0; i < size; i++)
-                buf[i].flag = SET_FLAG_EMPTY;
-            return buf;
+            this->cap = cap;
+            this->count = 0;
+            this->used = 0;
+            this->removed = 0;
+            this->ctrl = (int8_t *)this->allocator->allocate_raw(cap + sizeof(T) * cap);
+            this->slots = (T *)(this->ctrl + cap);
+            memset(this->ctrl, SET_CTRL_EMPTY, cap);
         }
-        void free(Bucket<T> *buffer)
+        void free(int8_t *ctrl)
         {
-            this->allocator->deallocate_raw(buffer);
+            this->allocator->deallocate_raw(ctrl);
         }
-        void grow()
+        // Runs when live and dead slots reach the load limit, or when half
+        // a capacity of elements were removed since the last rehash and
+        // the survivors fill less than an eighth of the limit. The new
+        // capacity is the smallest that leaves the live elements at most
+        // half of the limit: a full set grows, a set that is mostly dead
+        // slots is rebuilt at the same size, and one that emptied out
+        // shrinks. Either way as many inserts as there are live elements
+        // fit before the next rehash, so churn costs amortized O(1).
+        void rehash()
         {
             size_t oldcap = this->cap;
-            this->cap = this->cap * SET_GROWTH_RATE;
-            Bucket<T> *oldbuffer = this->buffer;
-            this->buffer = this->allocate(this->cap);
+            int8_t *oldctrl = this->ctrl;
+            T *oldslots = this->slots;
+            size_t newcap = SET_MIN_CAPACITY;
+            while (this->count * 2 > SET_MAX_LOAD(newcap))
+                newcap *= SET_GROWTH_RATE;
+            this->allocate(newcap);
+            this->layout++;
             for (size_t i = 0; i < oldcap; i++)
             {
-                if (oldbuffer[i].flag == SET_FLAG_FULL)
-                    this->insert(oldbuffer[i].val);
+                if (oldctrl[i] >= 0)
+                {
+                    hash_t h = H()(oldslots[i]);
+                    this->place(this->search_free(h), h, oldslots[i]);
+                }
             }
-            this->free(oldbuffer);
+            this->free(oldctrl);
         }
 
     public:
-        void init(key_compare<T> comp, key_hash<T> hash, IAllocator *allocator, size_t cap = 16)
+        // room for expected elements before the first rehash
+        void init(IAllocator *allocator, size_t expected = 0)
         {
-            this->comp = comp;
-            this->hash = hash;
+            size_t cap = SET_MIN_CAPACITY;
+            while (SET_MAX_LOAD(cap) < expected)
+                cap *= SET_GROWTH_RATE;
             this->allocator = allocator;
-            this->cap = cap;
-            this->count = 0;
-            this->buffer = this->allocate(cap);
+            this->layout = 0;
+            this->allocate(cap);
+        }
+        // a copy of other, control bytes and slots are copied as they are
+        void init(IAllocator *allocator, const Set &other)
+        {
+            this->allocator = allocator;
+            this->layout = 0;
+            this->allocate(other.cap);
+            memcpy(this->ctrl, other.ctrl, other.cap + sizeof(T) * other.cap);
+            this->count = other.count;
+            this->used = other.used;
         }
         void destroy()
         {
-            this->free(buffer);
+            this->free(this->ctrl);
         }
         void insert(T ele)
         {
-            if (this->calc_load() > SET_LOAD_FACTOR)
+            hash_t h = H()(ele);
+            T *slot = this->search(ele, h);
+            if (slot)
             {
-                this->grow();
-            }
-            Bucket<T> *buck = this->search(ele);
-            buck->val = ele;
-            if (buck->flag != SET_FLAG_FULL)
-            {
-                buck->flag = SET_FLAG_FULL;
-                this->count++;
+                *slot = ele;
+                return;
             }
+            if (this->used + 1 > SET_MAX_LOAD(this->cap) ||
+                (this->removed > this->cap / 2 && this->count * 8 < SET_MAX_LOAD(this->cap)))
+                this->rehash();
+            this->place(this->search_free(h), h, ele);
         }
         void remove(const T &ele)
         {
-            Bucket<T> *buck = this->search(ele);
-            if (buck->flag != SET_FLAG_FULL)
+            T *slot = this->search(ele, H()(ele));
+            if (!slot)
                 return;
-            buck->flag = SET_FLAG_DEAD;
-            while (
-                buck->flag == SET_FLAG_DEAD &&
-                next(buck)->flag == SET_FLAG_EMPTY)
+            // a group that still has an empty slot never had a probe pass
+            // through it, so the slot can become empty instead of dead
+            size_t idx = slot - this->slots;
+            size_t base = idx / SET_GROUP_WIDTH * SET_GROUP_WIDTH;
+            if (SetGroup(this->ctrl + base).match_empty())
             {
-                buck = prev(buck);
+                this->ctrl[idx] = SET_CTRL_EMPTY;
+                this->used--;
             }
+            else
+                this->ctrl[idx] = SET_CTRL_DEAD;
+            this->count--;
+            this->removed++;
+            this->layout++;
         }
         T *get(const T &ele) const
         {
-            Bucket<T> *buck = this->search(ele);
-            if (buck->flag == SET_FLAG_FULL)
-            {
-                return &buck->val;
-            }
-            else
-            {
-                return nullptr;
-            }
+            return this->search(ele, H()(ele));
+        }
+        // changes whenever an element is removed or moved, pointers
+        // returned by get stay valid while it does not
+        size_t version() const
+        {
+            return this->layout;
         }
-        bool contains(const T &ele)
+        size_t size() const
         {
-            return this->search(ele)->flag == SET_FLAG_FULL;
+            return this->count;
         }
-        T &operator[](const T &ele)
+        size_t capacity() const
         {
-            return this->search(ele)->val;
+            return this->cap;
         }
         T *iter(int &idx) const
         {
@@ -181,10 +296,10 @@ namespace luayed
                 idx++;
                 if (idx >= (int)this->cap)
                     return nullptr;
-            } while (this->buffer[idx].flag != SET_FLAG_FULL);
-            return &this->buffer[idx].val;
+            } while (this->ctrl[idx] < 0);
+            return &this->slots[idx];
         }
     };
 
 };
-#endif
\ No newline at end of file
+#endif
@@ -56,6 +56,7 @@ namespace luayed
         DotDotDot = 0x0103,
         Identifier = 0x0104,
         Number = 0x0105,
+        Integer = 0x0106,
         // etc
         Equal = 0x0001,
         Comma = 0x0002,
@@ -17,7 +17,12 @@ namespace luayed
         virtual size_t len() = 0;
 
         virtual size_t const_number(lnumber num) = 0;
+        virtual size_t const_integer(linteger num) = 0;
         virtual size_t const_string(const char *str) = 0;
+        virtual size_t const_boolean(bool b) = 0;
+        // a table template built from constants of the current function,
+        // fields holds key and value indexes in constructor order
+        virtual size_t const_table(const vector<size_t> &fields, size_t narr, size_t nrec) = 0;
         virtual void debug_info(size_t line) = 0;
 
         virtual fidx_t pushf() = 0;
@@ -36,10 +41,13 @@ namespace luayed
         virtual LuaValue create_nil() = 0;
         virtual LuaValue create_boolean(bool b) = 0;
         virtual LuaValue create_number(lnumber n) = 0;
+        virtual LuaValue create_integer(linteger n) = 0;
         virtual LuaValue create_string(lnumber n) = 0;
+        virtual LuaValue create_string(linteger n) = 0;
         virtual LuaValue create_string(const char *s) = 0;
         virtual LuaValue create_string(const char *s1, const char *s2) = 0;
-        virtual LuaValue create_table() = 0;
+        virtual LuaValue create_table(size_t narr = 0, size_t nrec = 0) = 0;
+        virtual LuaValue clone_table(LuaValue t) = 0;
         virtual LuaValue create_luafn(fidx_t fidx) = 0;
 
         virtual void store_ip(size_t ip) = 0;
@@ -47,6 +55,7 @@ namespace luayed
 
         virtual void table_set(LuaValue t, LuaValue k, LuaValue v) = 0;
         virtual LuaValue table_get(LuaValue t, LuaValue k) = 0;
+        virtual size_t table_length(LuaValue t) = 0;
         virtual LuaValue table_global() = 0;
 
         virtual void set_error(LuaValue value) = 0;
@@ -70,7 +79,9 @@ namespace luayed
         virtual Hook *upvalue(size_t idx) = 0;
         virtual LuaValue rodata(size_t idx) = 0;
         virtual lbyte *text() = 0;
-        virtual size_t length(const char *str) = 0;
+        virtual Dinstruction *code() = 0;
+        virtual uint32_t *textpos() = 0;
+        virtual size_t length(LuaValue s) = 0;
         virtual dbginfo_t *dbgmd() = 0;
         virtual LuaValue chunkname() = 0;
         virtual void check_garbage_collection() = 0;
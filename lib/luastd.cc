@@ -18,7 +18,10 @@ string luastd::luavalue_to_string(Lua *lua)
     else if (k == LUA_TYPE_NUMBER)
     {
         poped = true;
-        str = luayed::to_string(lua->pop_number());
+        if (lua->is_int())
+            str = std::to_string(lua->pop_integer());
+        else
+            str = luayed::to_string(lua->pop_number());
     }
     else if (k == LUA_TYPE_STRING)
     {
@@ -51,7 +54,7 @@ size_t luastd::unpack(Lua *lua)
     while (true)
     {
         lua->fetch_local(-1); // table
-        lua->push_number(count);
+        lua->push_integer(count);
         lua->get_table();
         if (lua->kind() == LUA_TYPE_NIL)
         {
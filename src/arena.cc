@@ -0,0 +1,102 @@
+#include "arena.h"
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace luayed;
+
+// maps twice the size and unmaps what sticks out of the aligned page
+static void *map_page()
+{
+    size_t len = 2 * ARENA_PAGE_SIZE;
+    char *ptr = (char *)mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        abort();
+    uintptr_t addr = (uintptr_t)ptr;
+    char *page = (char *)((addr + ARENA_PAGE_SIZE - 1) & ~(uintptr_t)(ARENA_PAGE_SIZE - 1));
+    if (page > ptr)
+        munmap(ptr, page - ptr);
+    munmap(page + ARENA_PAGE_SIZE, ptr + len - (page + ARENA_PAGE_SIZE));
+    return page;
+}
+static void unmap_page(ArenaPage *page)
+{
+    munmap(page, ARENA_PAGE_SIZE);
+}
+
+Arena::Arena()
+{
+    for (size_t i = 0; i < ARENA_CLASSES; i++)
+        this->partial[i] = nullptr;
+    this->empty = nullptr;
+    this->all = nullptr;
+    this->pages = 0;
+    this->empties = 0;
+    this->used = 0;
+}
+Arena::~Arena()
+{
+    while (ArenaPage *page = this->all)
+    {
+        this->all = page->all_next;
+        unmap_page(page);
+    }
+}
+ArenaPage *Arena::take_page(size_t cls)
+{
+    ArenaPage *page = this->empty;
+    if (page)
+    {
+        this->unlink(page, &this->empty);
+        this->empties--;
+    }
+    else
+    {
+        page = (ArenaPage *)map_page();
+        page->all_prev = nullptr;
+        page->all_next = this->all;
+        if (this->all)
+            this->all->all_prev = page;
+        this->all = page;
+        this->pages++;
+    }
+    page->free = nullptr;
+    page->unused = (char *)page + ARENA_PAGE_HEADER;
+    page->slot = (cls + 1) * ARENA_GRANULE;
+    page->live = 0;
+    page->capacity = (ARENA_PAGE_SIZE - ARENA_PAGE_HEADER) / page->slot;
+    memset(page->marks, 0, sizeof(page->marks));
+    this->link(page, &this->partial[cls]);
+    return page;
+}
+void Arena::trim()
+{
+    while (this->empties > ARENA_SPARE_PAGES)
+    {
+        ArenaPage *page = this->empty;
+        this->unlink(page, &this->empty);
+        if (page->all_prev)
+            page->all_prev->all_next = page->all_next;
+        else
+            this->all = page->all_next;
+        if (page->all_next)
+            page->all_next->all_prev = page->all_prev;
+        unmap_page(page);
+        this->empties--;
+        this->pages--;
+    }
+}
+void Arena::clear_marks()
+{
+    for (ArenaPage *page = this->all; page; page = page->all_next)
+        memset(page->marks, 0, sizeof(page->marks));
+}
+ArenaStats Arena::stats() const
+{
+    ArenaStats stats;
+    stats.mapped = this->pages * ARENA_PAGE_SIZE;
+    stats.used = this->used;
+    stats.empty = this->empties * ARENA_PAGE_SIZE;
+    stats.free = stats.mapped - stats.empty - stats.used;
+    return stats;
+}
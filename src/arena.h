@@ -0,0 +1,189 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// slot sizes are multiples of the granule
+#define ARENA_GRANULE 16
+// larger objects are left to malloc
+#define ARENA_MAX_SIZE 256
+#define ARENA_CLASSES (ARENA_MAX_SIZE / ARENA_GRANULE)
+// pages are mapped one by one and aligned to their size
+#define ARENA_PAGE_SIZE (64 * 1024)
+// empty pages kept mapped by trim for the next allocations
+#define ARENA_SPARE_PAGES 4
+// one mark bit per granule of the page
+#define ARENA_MARK_WORDS (ARENA_PAGE_SIZE / ARENA_GRANULE / 64)
+// the first byte of a free slot, no object in use may start with it
+#define ARENA_FREE 0xff
+// the slots of a page start after its header
+#define ARENA_PAGE_HEADER ((sizeof(ArenaPage) + ARENA_GRANULE - 1) / ARENA_GRANULE * ARENA_GRANULE)
+
+namespace luayed
+{
+    struct ArenaStats
+    {
+        size_t mapped;
+        // bytes in the slots handed out
+        size_t used;
+        // bytes of the pages holding live slots that are not in one
+        size_t free;
+        // bytes of the pages without live slots, waiting for trim
+        size_t empty;
+    };
+
+    struct ArenaPage
+    {
+        ArenaPage *next;
+        ArenaPage *prev;
+        // every mapped page, newest first
+        ArenaPage *all_next;
+        ArenaPage *all_prev;
+        // slots freed since the page was taken, linked through their
+        // second word
+        void *free;
+        // slots never handed out start here
+        char *unused;
+        size_t slot;
+        size_t live;
+        size_t capacity;
+        uint64_t marks[ARENA_MARK_WORDS];
+
+        char *first()
+        {
+            return (char *)this + ARENA_PAGE_HEADER;
+        }
+    };
+
+    // Segregated allocator for the small objects of the heap. Every size
+    // class has its own pages, a slot's page is found by masking its
+    // address, so freeing needs neither a size nor a search. Pages with a
+    // free slot are in the list of their class, full ones in no list and
+    // the ones whose slots were all freed wait for trim, which unmaps them
+    // all at once after a collection. The collector keeps its mark bits
+    // in a bitmap at the start of each page, so marking does not write to
+    // the objects, and sweeps the pages slot by slot.
+    class Arena
+    {
+    private:
+        ArenaPage *partial[ARENA_CLASSES];
+        ArenaPage *empty;
+        ArenaPage *all;
+        size_t pages;
+        size_t empties;
+        size_t used;
+
+        static ArenaPage *page_of(const void *ptr)
+        {
+            return (ArenaPage *)((uintptr_t)ptr & ~(uintptr_t)(ARENA_PAGE_SIZE - 1));
+        }
+        static size_t mark_bit(const void *ptr)
+        {
+            return ((uintptr_t)ptr & (ARENA_PAGE_SIZE - 1)) / ARENA_GRANULE;
+        }
+        void link(ArenaPage *page, ArenaPage **list)
+        {
+            page->prev = nullptr;
+            page->next = *list;
+            if (*list)
+                (*list)->prev = page;
+            *list = page;
+        }
+        void unlink(ArenaPage *page, ArenaPage **list)
+        {
+            if (page->prev)
+                page->prev->next = page->next;
+            else
+                *list = page->next;
+            if (page->next)
+                page->next->prev = page->prev;
+        }
+        ArenaPage *take_page(size_t cls);
+
+    public:
+        Arena();
+        ~Arena();
+
+        // size is at most ARENA_MAX_SIZE
+        void *allocate(size_t size)
+        {
+            size_t cls = (size - 1) / ARENA_GRANULE;
+            ArenaPage *page = this->partial[cls];
+            if (!page)
+                page = this->take_page(cls);
+            void *slot;
+            if (page->free)
+            {
+                slot = page->free;
+                page->free = ((void **)slot)[1];
+            }
+            else
+            {
+                slot = page->unused;
+                page->unused += page->slot;
+            }
+            if (++page->live == page->capacity)
+                this->unlink(page, &this->partial[cls]);
+            this->used += page->slot;
+            return slot;
+        }
+        void deallocate(void *ptr)
+        {
+            ArenaPage *page = page_of(ptr);
+            ArenaPage **list = &this->partial[page->slot / ARENA_GRANULE - 1];
+            *(uint8_t *)ptr = ARENA_FREE;
+            ((void **)ptr)[1] = page->free;
+            page->free = ptr;
+            this->used -= page->slot;
+            if (page->live-- == page->capacity)
+                this->link(page, list);
+            if (page->live == 0)
+            {
+                this->unlink(page, list);
+                this->link(page, &this->empty);
+                this->empties++;
+            }
+        }
+        // the slot size of ptr
+        static size_t size(void *ptr)
+        {
+            return page_of(ptr)->slot;
+        }
+        // the mark bits are read atomically, threads of a parallel mark
+        // set them concurrently
+        static bool marked(const void *ptr)
+        {
+            size_t bit = mark_bit(ptr);
+            return (__atomic_load_n(&page_of(ptr)->marks[bit / 64], __ATOMIC_RELAXED) >> (bit % 64)) & 1;
+        }
+        // sets the mark bit, true when it already was
+        static bool test_and_mark(const void *ptr)
+        {
+            size_t bit = mark_bit(ptr);
+            uint64_t mask = (uint64_t)1 << (bit % 64);
+            return __atomic_fetch_or(&page_of(ptr)->marks[bit / 64], mask, __ATOMIC_RELAXED) & mask;
+        }
+        static void mark(const void *ptr)
+        {
+            size_t bit = mark_bit(ptr);
+            page_of(ptr)->marks[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+        static void unmark(const void *ptr)
+        {
+            size_t bit = mark_bit(ptr);
+            page_of(ptr)->marks[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+        }
+        void clear_marks();
+        // pages mapped later are in front of the ones mapped before
+        ArenaPage *first_page() const
+        {
+            return this->all;
+        }
+        // unmaps the empty pages but a few spares
+        void trim();
+        ArenaStats stats() const;
+    };
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "compiler.h"
+#include <algorithm>
+#include <cerrno>
 
 #define EXPECT_FREE 0xffff
 
@@ -12,6 +14,7 @@ int cdec(char c)
 {
     return (c <= '9' && c >= '0') ? (c - '0') : -1;
 }
+Opcode branch_opcode(lbyte cmp, bool negated);
 
 string Compiler::scan_lua_multiline_string(Token t)
 {
@@ -103,11 +106,19 @@ string Compiler::scan_lua_string(Token t)
         return scan_lua_singleline_string(t);
 }
 
-lnumber Compiler::token_number(Token t)
+size_t Compiler::token_const(Token t)
 {
     string tstr = t.text(this->source);
-    lnumber num = atof(tstr.c_str());
-    return num;
+    if (t.kind == TokenKind::Integer)
+    {
+        // integers too large for 64 bits become floats, like in Lua 5.3
+        bool hex = tstr.size() > 1 && tstr[1] == 'x';
+        errno = 0;
+        linteger num = strtoll(tstr.c_str(), nullptr, hex ? 16 : 10);
+        if (errno != ERANGE)
+            return this->gen->const_integer(num);
+    }
+    return this->const_number(atof(tstr.c_str()));
 }
 
 fidx_t Compiler::compile(Noderef root, const char *chunckname)
@@ -148,6 +159,8 @@ fidx_t Compiler::compile(Noderef root, const char *chunckname)
     this->gen->meta_hookmax(this->hookmax);
     this->gen->meta_chunkname(chunckname);
     this->emit(Instruction(Opcode::IRet, 0));
+    if (this->superinstructions)
+        this->select_superinstructions();
     for (size_t i = 0; i < this->instructions.size(); i++)
     {
         this->gen->debug_info(this->instructions[i].dbg);
@@ -222,7 +235,6 @@ size_t Compiler::len()
 void Compiler::compile_if(Noderef node)
 {
     vector<size_t> jmps;
-    size_t cjmp = 0;
     foreach_node(node, cls)
     {
         if (cls->get_kind() == NodeKind::ElseClause)
@@ -231,15 +243,14 @@ void Compiler::compile_if(Noderef node)
         }
         else
         {
-            this->compile_exp(cls->child(0));
-            this->emit(Opcode::INot);
-            cjmp = this->len();
-            this->emit(Instruction(Opcode::ICjmp, 0));
+            vector<size_t> cjmps;
+            this->compile_condition(cls->child(0), false, cjmps);
             this->compile_block(cls->child(1));
             jmps.push_back(this->len());
             this->emit(Instruction(Opcode::IJmp, 0));
             size_t cjmp_idx = this->binsize;
-            this->edit_jmp(cjmp, cjmp_idx);
+            for (size_t i = 0; i < cjmps.size(); i++)
+                this->edit_jmp(cjmps[i], cjmp_idx);
         }
     }
     size_t jmp_idx = this->binsize;
@@ -344,9 +355,9 @@ void Compiler::compile_primary(Noderef node, size_t expect)
         this->emit(Opcode::IFalse);
     else if (tkn.kind == TokenKind::Nil)
         this->emit(Opcode::INil);
-    else if (tkn.kind == TokenKind::Number)
+    else if (tkn.kind == TokenKind::Number || tkn.kind == TokenKind::Integer)
     {
-        size_t idx = this->const_number(token_number(tkn));
+        size_t idx = this->token_const(tkn);
         this->emit(Instruction(Opcode::IConst, idx));
     }
     else if (tkn.kind == TokenKind::Literal)
@@ -359,25 +370,35 @@ void Compiler::compile_primary(Noderef node, size_t expect)
         this->compile_identifier(node);
     }
 }
-void Compiler::compile_name(Noderef node)
-{
-    Token tkn = node->get_token();
-    size_t idx = this->const_string(tkn.text(this->source).c_str());
-    this->emit(Instruction(Opcode::IConst, idx));
-}
 
 void Compiler::compile_table(Noderef node)
 {
-    this->emit(Instruction(Opcode::ITNew));
+    // presize for the fields the constructor sets, a trailing call or
+    // vararg expands to an unknown count and is left to grow the array
+    size_t narr = 0, nrec = 0;
+    foreach_node(node, ch)
+    {
+        if (ch->get_kind() == NodeKind::IdField || ch->get_kind() == NodeKind::ExprField)
+            nrec++;
+        else if (!(ch == node->end() && (is_call(ch) || is_vargs(ch))))
+            narr++;
+    }
+    if (narr + nrec && this->superinstructions && this->compile_table_template(node, narr, nrec))
+        return;
+    this->emit(Instruction(Opcode::ITNew, std::min(narr, (size_t)UINT16_MAX), std::min(nrec, (size_t)UINT16_MAX)));
     size_t list_len = 0;
     if (!node->child_count())
         return;
     foreach_node(node, ch)
     {
+        // constant keys are folded into ITSetK with superinstructions
+        size_t keyidx = SIZE_MAX;
+        Noderef value = ch;
         if (ch->get_kind() == NodeKind::IdField)
         {
-            this->compile_name(ch->child(0));
-            this->compile_exp(ch->child(1));
+            Token tkn = ch->child(0)->get_token();
+            keyidx = this->const_string(tkn.text(this->source).c_str());
+            value = ch->child(1);
         }
         else if (ch->get_kind() == NodeKind::ExprField)
         {
@@ -392,16 +413,78 @@ void Compiler::compile_table(Noderef node)
         }
         else
         {
-            size_t key = (list_len++) + 1;
-            size_t keyidx = this->const_number(key);
+            keyidx = this->gen->const_integer(++list_len);
+        }
+        if (keyidx != SIZE_MAX && this->superinstructions)
+        {
+            this->compile_exp(value);
+            this->emit(Instruction(Opcode::ITSetK, keyidx));
+            continue;
+        }
+        if (keyidx != SIZE_MAX)
+        {
             this->emit(Instruction(Opcode::IConst, keyidx));
-            this->compile_exp(ch);
+            this->compile_exp(value);
         }
         this->emit(Opcode::ITSet);
         if (ch->get_kind() == NodeKind::ExprField)
             this->debug_info(DEBUG_INFO_TYPE_NORMAL, ch->child(0)->line());
     }
 }
+bool Compiler::is_literal(Noderef node)
+{
+    if (node->get_kind() != NodeKind::Primary)
+        return false;
+    TokenKind kind = node->get_token().kind;
+    return kind == TokenKind::Number || kind == TokenKind::Integer || kind == TokenKind::Literal ||
+           kind == TokenKind::True || kind == TokenKind::False;
+}
+size_t Compiler::literal_const(Noderef node)
+{
+    Token tkn = node->get_token();
+    if (tkn.kind == TokenKind::Literal)
+        return this->const_string(scan_lua_string(tkn).c_str());
+    if (tkn.kind == TokenKind::True || tkn.kind == TokenKind::False)
+        return this->gen->const_boolean(tkn.kind == TokenKind::True);
+    return this->token_const(tkn);
+}
+// constructors whose keys and values are all literals are built once into
+// a template among the constants and cloned, false when node is not one
+bool Compiler::compile_table_template(Noderef node, size_t narr, size_t nrec)
+{
+    foreach_node(node, ch)
+    {
+        if (ch->get_kind() == NodeKind::IdField && !is_literal(ch->child(1)))
+            return false;
+        if (ch->get_kind() == NodeKind::ExprField && !(is_literal(ch->child(0)) && is_literal(ch->child(1))))
+            return false;
+        if (ch->get_kind() != NodeKind::IdField && ch->get_kind() != NodeKind::ExprField && !is_literal(ch))
+            return false;
+    }
+    vector<size_t> fields;
+    size_t list_len = 0;
+    foreach_node(node, ch)
+    {
+        if (ch->get_kind() == NodeKind::IdField)
+        {
+            Token tkn = ch->child(0)->get_token();
+            fields.push_back(this->const_string(tkn.text(this->source).c_str()));
+            fields.push_back(this->literal_const(ch->child(1)));
+        }
+        else if (ch->get_kind() == NodeKind::ExprField)
+        {
+            fields.push_back(this->literal_const(ch->child(0)));
+            fields.push_back(this->literal_const(ch->child(1)));
+        }
+        else
+        {
+            fields.push_back(this->gen->const_integer(++list_len));
+            fields.push_back(this->literal_const(ch));
+        }
+    }
+    this->emit(Instruction(Opcode::ITClone, this->gen->const_table(fields, narr, nrec)));
+    return true;
+}
 void Compiler::debug_info(int type, size_t line)
 {
     this->instructions.back().dbg = DEBUG_INFO(type, line);
@@ -419,7 +502,7 @@ void Compiler::compile_exp_e(Noderef node, size_t expect)
         TokenKind tk = node->child(1)->get_token().kind;
         if (tk == TokenKind::And || tk == TokenKind::Or)
             this->compile_logic(node);
-        else
+        else if (!this->register_ops || !this->compile_reg_binary(node, REG_STACK))
         {
             this->compile_exp(node->child(0));
             this->compile_exp(node->child(2));
@@ -467,11 +550,94 @@ Compiler::Compiler(IGenerator *gen) : gen(gen)
 {
 }
 
+void Compiler::config_register_ops(bool val)
+{
+    this->register_ops = val;
+}
+
+void Compiler::config_superinstructions(bool val)
+{
+    this->superinstructions = val;
+}
+
+size_t Compiler::reg_local(Noderef node)
+{
+    MetaDeclaration *md = (MetaDeclaration *)node->metadata_decl();
+    size_t offset = REG_STACK;
+    if (md && !md->is_upvalue)
+        offset = ((MetaMemory *)md->decnode->metadata_memory())->offset;
+    else if (!md && node->metadata_self())
+        offset = 0;
+    return offset < REG_CONST ? offset : REG_STACK;
+}
+
+size_t Compiler::reg_direct(Noderef node)
+{
+    if (node->get_kind() != NodeKind::Primary)
+        return REG_STACK;
+    Token tkn = node->get_token();
+    size_t idx = REG_STACK;
+    if (tkn.kind == TokenKind::Identifier)
+        return this->reg_local(node);
+    else if (tkn.kind == TokenKind::Number || tkn.kind == TokenKind::Integer)
+        idx = this->token_const(tkn);
+    else if (tkn.kind == TokenKind::Literal)
+        idx = this->const_string(scan_lua_string(tkn).c_str());
+    return idx < REG_STACK - REG_CONST ? (idx | REG_CONST) : REG_STACK;
+}
+
+bool Compiler::compile_reg_binary(Noderef node, size_t dst)
+{
+    Token op = node->child(1)->get_token();
+    Opcode opc = this->translate_token(op.kind, true);
+    if (opc < Opcode::IAdd || opc > Opcode::IPow)
+        return false;
+    size_t b = this->reg_direct(node->child(0));
+    size_t c = this->reg_direct(node->child(2));
+    // nothing to gain over the stack instruction
+    if (dst == REG_STACK && b == REG_STACK && c == REG_STACK)
+        return false;
+    if (b == REG_STACK)
+        this->compile_exp(node->child(0));
+    if (c == REG_STACK)
+        this->compile_exp(node->child(2));
+    this->emit(Instruction((Opcode)(Opcode::IRAdd + (opc - Opcode::IAdd)), dst, b, c));
+    this->debug_info(DEBUG_INFO_TYPE_NORMAL, op.line);
+    return true;
+}
+
+bool Compiler::compile_reg_assignment(Noderef node)
+{
+    Noderef varlist = node->child(0);
+    Noderef explist = node->child(1);
+    if (varlist->child_count() != 1 || explist->child_count() != 1)
+        return false;
+    Noderef var = varlist->child(0);
+    Noderef exp = explist->child(0);
+    if (var->get_kind() != NodeKind::Primary && var->get_kind() != NodeKind::Name)
+        return false;
+    size_t dst = this->reg_local(var);
+    if (dst == REG_STACK)
+        return false;
+    if (exp->get_kind() == NodeKind::Binary)
+    {
+        TokenKind tk = exp->child(1)->get_token().kind;
+        return tk != TokenKind::And && tk != TokenKind::Or && this->compile_reg_binary(exp, dst);
+    }
+    size_t src = this->reg_direct(exp);
+    if (src == REG_STACK)
+        return false;
+    this->emit(Instruction(Opcode::IRMove, dst, src));
+    return true;
+}
+
 void Compiler::compile_function(Noderef node)
 {
     MetaScope *fnscp = node->metadata_scope();
     Compiler compiler(this->gen);
     compiler.source = this->source;
+    compiler.register_ops = this->register_ops;
+    compiler.superinstructions = this->superinstructions;
     compiler.compile(node, this->chunckname);
     this->emit(Instruction(Opcode::IFConst, fnscp->fidx));
 }
@@ -512,8 +678,13 @@ void Compiler::compile_lvalue_primary(Noderef node)
     }
     else
     {
-        const char *str = node->get_token().text(this->source).c_str();
-        size_t idx = this->const_string(str);
+        string str = node->get_token().text(this->source);
+        size_t idx = this->const_string(str.c_str());
+        if (this->superinstructions)
+        {
+            this->ops_push(Instruction(Opcode::IGSetK, idx));
+            return;
+        }
         this->emit(Instruction(Opcode::IConst, idx));
         this->ops_push(Opcode::IGSet);
         this->vstack.push_back(1);
@@ -533,8 +704,14 @@ bool Compiler::compile_lvalue(Noderef node)
         Noderef prop = node->child(1);
         this->compile_exp(lexp);
         Token prop_tkn = prop->get_token();
-        const char *prop_str = prop_tkn.text(this->source).c_str();
-        size_t idx = this->const_string(prop_str);
+        string prop_str = prop_tkn.text(this->source);
+        size_t idx = this->const_string(prop_str.c_str());
+        if (this->superinstructions)
+        {
+            this->ops_push(Instruction(Opcode::ITSetK, idx), prop_tkn.line);
+            this->vstack.push_back(1);
+            return true;
+        }
         this->emit(Instruction(Opcode::IConst, idx));
         this->ops_push(Instruction(Opcode::ITSet), prop_tkn.line);
         this->vstack.push_back(1);
@@ -759,26 +936,18 @@ void Compiler::compile_numeric_for(Noderef node)
         this->compile_exp(node->child(3));
     }
     else
-        this->emit(Instruction(Opcode::IConst, this->const_number(1)));
-    size_t loop_start = this->binsize;
-    // condition
-    this->emit(Instruction(Opcode::IBLocal, 3)); // index
-    this->emit(Instruction(Opcode::IBLocal, 3)); // limit
-    this->emit(Opcode::IGt);
+        this->emit(Instruction(Opcode::IConst, this->gen->const_integer(1)));
+    // skip the loop when the range is empty
+    size_t prep = this->len();
+    this->emit(Instruction(Opcode::IForPrep, 0));
     this->debug_info(DEBUG_INFO_TYPE_NUMFOR, lvalue->line());
-    // jmp to end
-    size_t jmp = this->len();
-    this->emit(Instruction(Opcode::ICjmp, 0));
+    size_t loop_start = this->binsize;
     // block
     this->compile_block(node->child(blk_idx));
-    // increment
-    this->emit(Instruction(Opcode::IBLocal, 3)); // index
-    this->emit(Instruction(Opcode::IBLocal, 2)); // step
-    this->emit(Opcode::IAdd);
+    // step and jump back while in range
+    this->emit(Instruction(Opcode::IForLoop, loop_start));
     this->debug_info(DEBUG_INFO_TYPE_NUMFOR, lvalue->line());
-    this->emit(Instruction(Opcode::IBLStore, 3));
-    this->emit(Instruction(Opcode::IJmp, loop_start));
-    this->edit_jmp(jmp, this->binsize);
+    this->edit_jmp(prep, this->binsize);
     if (md->is_upvalue)
     {
         this->hookpop();
@@ -789,6 +958,8 @@ void Compiler::compile_numeric_for(Noderef node)
 
 void Compiler::compile_assignment(Noderef node)
 {
+    if (this->register_ops && this->compile_reg_assignment(node))
+        return;
     size_t vcount = node->child(0)->child_count();
     size_t varlc = this->compile_varlist(node->child(0));
     this->compile_explist(node->child(1), vcount);
@@ -811,14 +982,59 @@ void Compiler::compile_assignment(Noderef node)
 void Compiler::compile_logic(Noderef node)
 {
     this->compile_exp(node->child(0));
-    this->emit(Instruction(Opcode::IBLocal, 1));
+    size_t jmp = this->len();
     if (node->child(1)->get_token().kind == TokenKind::And)
-        this->emit(Opcode::INot);
-    size_t cjmp = this->len();
-    this->emit(Instruction(Opcode::ICjmp, 0));
-    this->emit(Instruction(Opcode::IPop, 1));
+        this->emit(Instruction(Opcode::IAndJmp, 0));
+    else
+        this->emit(Instruction(Opcode::IOrJmp, 0));
     this->compile_exp(node->child(2));
-    this->edit_jmp(cjmp, this->binsize);
+    this->edit_jmp(jmp, this->binsize);
+}
+
+void Compiler::compile_condition(Noderef node, bool jump_if, vector<size_t> &jmps)
+{
+    if (node->get_kind() == NodeKind::Unary && node->child(0)->get_token().kind == TokenKind::Not)
+        return this->compile_condition(node->child(1), !jump_if, jmps);
+    if (node->get_kind() == NodeKind::Primary && node->get_token().kind == TokenKind::True && !jump_if)
+        return;
+    if (node->get_kind() == NodeKind::Binary)
+    {
+        Token op = node->child(1)->get_token();
+        if (op.kind == TokenKind::And || op.kind == TokenKind::Or)
+        {
+            // the left operand decides alone when it is false for and, true for or
+            bool decisive = op.kind == TokenKind::Or;
+            if (jump_if == decisive)
+            {
+                this->compile_condition(node->child(0), jump_if, jmps);
+                this->compile_condition(node->child(2), jump_if, jmps);
+                return;
+            }
+            vector<size_t> skips;
+            this->compile_condition(node->child(0), decisive, skips);
+            this->compile_condition(node->child(2), jump_if, jmps);
+            for (size_t i = 0; i < skips.size(); i++)
+                this->edit_jmp(skips[i], this->binsize);
+            return;
+        }
+        Opcode opc = this->translate_token(op.kind, true);
+        if (opc >= Opcode::IEq && opc <= Opcode::ILt)
+        {
+            size_t a = this->reg_direct(node->child(0));
+            size_t b = this->reg_direct(node->child(2));
+            if (a == REG_STACK)
+                this->compile_exp(node->child(0));
+            if (b == REG_STACK)
+                this->compile_exp(node->child(2));
+            jmps.push_back(this->len());
+            this->emit(Instruction(branch_opcode(opc, !jump_if), 0, a, b));
+            this->debug_info(DEBUG_INFO_TYPE_NORMAL, op.line);
+            return;
+        }
+    }
+    this->compile_exp(node);
+    jmps.push_back(this->len());
+    this->emit(Instruction(jump_if ? Opcode::ICjmp : Opcode::IFjmp, 0));
 }
 
 void Compiler::compile_block(Noderef node)
@@ -901,22 +1117,22 @@ void Compiler::compile_ret(Noderef node)
 void Compiler::compile_while(Noderef node)
 {
     size_t jmp_idx = this->binsize;
-    this->compile_exp(node->child(0));
-    this->emit(Opcode::INot);
-    size_t cjmp = this->len();
-    this->emit(Instruction(Opcode::ICjmp, 0));
+    vector<size_t> cjmps;
+    this->compile_condition(node->child(0), false, cjmps);
     this->compile_block(node->child(1));
     this->emit(Instruction(Opcode::IJmp, jmp_idx));
-    this->edit_jmp(cjmp, this->binsize);
+    for (size_t i = 0; i < cjmps.size(); i++)
+        this->edit_jmp(cjmps[i], this->binsize);
 }
 
 void Compiler::compile_repeat(Noderef node)
 {
     size_t cjmp_idx = this->binsize;
+    vector<size_t> cjmps;
     this->compile_block(node->child(0));
-    this->compile_exp(node->child(1));
-    this->emit(Opcode::INot);
-    this->emit(Instruction(Opcode::ICjmp, cjmp_idx));
+    this->compile_condition(node->child(1), false, cjmps);
+    for (size_t i = 0; i < cjmps.size(); i++)
+        this->edit_jmp(cjmps[i], cjmp_idx);
 }
 void Compiler::compile_stack_diff(size_t gss, size_t lss)
 {
@@ -1062,4 +1278,155 @@ void Compiler::hookpush()
 void Compiler::hookpop()
 {
     this->hooksize--;
-}
\ No newline at end of file
+}
+
+// register operand addressing the value an instruction pushes, REG_STACK
+// when there is no such operand
+size_t push_operand(const Instruction &ins)
+{
+    if (ins.op == Opcode::ILocal && ins.oprnd1 < REG_CONST)
+        return ins.oprnd1;
+    if (ins.op == Opcode::IConst && ins.oprnd1 < REG_STACK - REG_CONST)
+        return ins.oprnd1 | REG_CONST;
+    return REG_STACK;
+}
+
+// compare and jump instruction replacing a comparison followed by a
+// conditional jump, negated when the comparison result is inverted first
+Opcode branch_opcode(lbyte cmp, bool negated)
+{
+    if (cmp == Opcode::IEq)
+        return negated ? Opcode::IRJNe : Opcode::IRJEq;
+    if (cmp == Opcode::INe)
+        return negated ? Opcode::IRJEq : Opcode::IRJNe;
+    if (cmp == Opcode::ILt)
+        return negated ? Opcode::IRJNLt : Opcode::IRJLt;
+    if (cmp == Opcode::ILe)
+        return negated ? Opcode::IRJNLe : Opcode::IRJLe;
+    if (cmp == Opcode::IGt)
+        return negated ? Opcode::IRJNGt : Opcode::IRJGt;
+    return negated ? Opcode::IRJNGe : Opcode::IRJGe;
+}
+
+size_t Compiler::fuse(size_t idx, const vector<bool> &targets, vector<Instruction> &selected)
+{
+    vector<Instruction> &text = this->instructions;
+    size_t left = text.size() - idx;
+    // jumps may only land on the first instruction of a fused sequence
+    size_t span = 1;
+    while (span < left && span < 5 && !targets[idx + span])
+        span++;
+    Instruction *ins = &text[idx];
+
+    // method self lookup
+    if (span >= 4 &&
+        ins[0].op == Opcode::IBLocal && ins[0].oprnd1 == 1 &&
+        ins[1].op == Opcode::IConst &&
+        ins[2].op == Opcode::ITGet &&
+        ins[3].op == Opcode::IBLStore && ins[3].oprnd1 == 2)
+    {
+        selected.push_back(Instruction(Opcode::ISelf, ins[1].oprnd1));
+        selected.back().dbg = ins[2].dbg;
+        return 4;
+    }
+
+    // up to two pushes of locals or constants consumed by a store, an arithmetic
+    // operator or by a comparison and a conditional jump
+    size_t oprnds[2] = {REG_STACK, REG_STACK};
+    size_t pushes = 0;
+    while (pushes < 2 && pushes < span && push_operand(ins[pushes]) != REG_STACK)
+        pushes++;
+    for (size_t i = 0; i < pushes; i++)
+        oprnds[2 - pushes + i] = push_operand(ins[i]);
+    if (pushes < span)
+    {
+        Instruction &op = ins[pushes];
+        // the result is stored straight into a local when one is popped next
+        bool store = pushes + 1 < span && ins[pushes + 1].op == Opcode::ILStore && ins[pushes + 1].oprnd1 < REG_CONST;
+        size_t dst = store ? ins[pushes + 1].oprnd1 : REG_STACK;
+        if (pushes && op.op >= Opcode::IAdd && op.op <= Opcode::IPow)
+        {
+            Opcode rop = (Opcode)(Opcode::IRAdd + (op.op - Opcode::IAdd));
+            selected.push_back(Instruction(rop, dst, oprnds[0], oprnds[1]));
+            selected.back().dbg = op.dbg;
+            return pushes + 1 + store;
+        }
+        if (pushes == 1 && op.op == Opcode::ILStore && op.oprnd1 < REG_CONST)
+        {
+            selected.push_back(Instruction(Opcode::IRMove, op.oprnd1, oprnds[1]));
+            return 2;
+        }
+        if (op.op >= Opcode::IEq && op.op <= Opcode::ILt)
+        {
+            bool negated = pushes + 2 < span && ins[pushes + 1].op == Opcode::INot;
+            size_t jmp = pushes + 1 + negated;
+            if (jmp < span && ins[jmp].op == Opcode::ICjmp)
+            {
+                Opcode bop = branch_opcode(op.op, negated);
+                selected.push_back(Instruction(bop, ins[jmp].oprnd1, oprnds[0], oprnds[1]));
+                selected.back().dbg = op.dbg;
+                return jmp + 1;
+            }
+        }
+    }
+
+    // table get with a constant key
+    if (span >= 2 && ins[0].op == Opcode::IConst && ins[1].op == Opcode::ITGet)
+    {
+        selected.push_back(Instruction(Opcode::ITGetK, ins[0].oprnd1));
+        selected.back().dbg = ins[1].dbg;
+        return 2;
+    }
+    // global get with a constant key
+    if (span >= 2 && ins[0].op == Opcode::IConst && ins[1].op == Opcode::IGGet)
+    {
+        selected.push_back(Instruction(Opcode::IGGetK, ins[0].oprnd1));
+        return 2;
+    }
+    return 0;
+}
+
+void Compiler::select_superinstructions()
+{
+    vector<Instruction> &text = this->instructions;
+    size_t count = text.size();
+    vector<size_t> offsets(count + 1, 0);
+    for (size_t i = 0; i < count; i++)
+        offsets[i + 1] = offsets[i] + text[i].encode().count;
+    vector<bool> targets(count + 1, false);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (op_is_jump(text[i].op))
+            targets[std::lower_bound(offsets.begin(), offsets.end(), text[i].oprnd1) - offsets.begin()] = true;
+    }
+
+    vector<Instruction> selected;
+    // index in the selected text of each instruction starting a sequence
+    vector<size_t> remap(count + 1, 0);
+    for (size_t i = 0; i < count;)
+    {
+        remap[i] = selected.size();
+        size_t len = this->fuse(i, targets, selected);
+        if (!len)
+        {
+            selected.push_back(text[i]);
+            len = 1;
+        }
+        i += len;
+    }
+    remap[count] = selected.size();
+
+    vector<size_t> soffsets(selected.size() + 1, 0);
+    for (size_t i = 0; i < selected.size(); i++)
+        soffsets[i + 1] = soffsets[i] + selected[i].encode().count;
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+        if (op_is_jump(selected[i].op))
+        {
+            size_t target = std::lower_bound(offsets.begin(), offsets.end(), selected[i].oprnd1) - offsets.begin();
+            selected[i].oprnd1 = soffsets[remap[target]];
+        }
+    }
+    this->instructions = selected;
+    this->binsize = soffsets.back();
+}
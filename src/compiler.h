@@ -23,6 +23,8 @@ namespace luayed
         size_t hooksize = 0;
         size_t hookmax = 0;
         size_t binsize = 0;
+        bool register_ops = false;
+        bool superinstructions = false;
 
         void hookpush();
         void hookpop();
@@ -45,7 +47,7 @@ namespace luayed
         void compile_block(Noderef node);
         void compile_primary(Noderef node, size_t expect);
         void compile_table(Noderef node);
-        void compile_name(Noderef node);
+        bool compile_table_template(Noderef node, size_t narr, size_t nrec);
         void compile_function(Noderef node);
         void compile_identifier(Noderef node);
         void compile_call(Noderef node, size_t expect);
@@ -60,6 +62,9 @@ namespace luayed
         void compile_repeat(Noderef node);
         void compile_exp(Noderef node);
         void compile_logic(Noderef node);
+        // emits the jumps taken when the truth of node equals jump_if and
+        // appends their indices to jmps, conditions are never materialized
+        void compile_condition(Noderef node, bool jump_if, vector<size_t> &jmps);
         void compile_numeric_for(Noderef node);
         void compile_generic_for(Noderef node);
         void compile_generic_for_swap(size_t varcount);
@@ -67,6 +72,12 @@ namespace luayed
         void compile_goto(Noderef node);
         void compile_label(Noderef node);
         void compile_exp_e(Noderef node, size_t expect);
+        size_t reg_local(Noderef node);
+        size_t reg_direct(Noderef node);
+        bool compile_reg_binary(Noderef node, size_t dst);
+        bool compile_reg_assignment(Noderef node);
+        void select_superinstructions();
+        size_t fuse(size_t idx, const vector<bool> &targets, vector<Instruction> &selected);
         void compile_stack_diff(size_t gss, size_t lss);
         void compile_hook_diff(size_t ghs, size_t lhs);
         size_t arglist_count(Noderef arglist);
@@ -76,11 +87,15 @@ namespace luayed
         string scan_lua_multiline_string(Token t);
         string scan_lua_singleline_string(Token t);
         string scan_lua_string(Token t);
-        lnumber token_number(Token t);
+        size_t token_const(Token t);
+        bool is_literal(Noderef node);
+        size_t literal_const(Noderef node);
 
     public:
         Compiler(IGenerator *gen);
         fidx_t compile(Ast ast, const char *source, const char *chunckname);
+        void config_register_ops(bool val);
+        void config_superinstructions(bool val);
     };
 };
 
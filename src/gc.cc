@@ -1,4 +1,8 @@
 #include "gc.h"
+#include <cstdlib>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #define gcheadptr(GCH, T) ((T *)(GCH + 1))
 
@@ -9,7 +13,14 @@ GCInspector inspector;
 
 using namespace luayed;
 
-void GarbageCollector::scan(gc_header_t *obj)
+static gc_header_t *value_header(LuaValue val)
+{
+    if (val.kind == LuaType::LVString)
+        return ((gc_header_t *)(((lstr_p)val.data.ptr) - 1)) - 1;
+    return ((gc_header_t *)val.data.ptr) - 1;
+}
+
+void Marker::scan(gc_header_t *obj)
 {
 #ifdef GC_DEBUG
     inspector.obj(obj + 1);
@@ -23,7 +34,7 @@ void GarbageCollector::scan(gc_header_t *obj)
     else if (obj->alloc_type == AllocType::ATBinary)
         this->scan(gcheadptr(obj, Lfunction));
 }
-void GarbageCollector::scan(Lfunction *bin)
+void Marker::scan(Lfunction *bin)
 {
     for (size_t i = 0; i < bin->inlen; i++)
     {
@@ -46,7 +57,7 @@ void GarbageCollector::scan(Lfunction *bin)
 #endif
     this->value(bin->chunkname);
 }
-void GarbageCollector::scan(LuaFunction *fn)
+void Marker::scan(LuaFunction *fn)
 {
     if (fn->is_lua)
     {
@@ -67,7 +78,7 @@ void GarbageCollector::scan(LuaFunction *fn)
         }
     }
 }
-void GarbageCollector::scan(Table *table)
+void Marker::scan(Table *table)
 {
     TableIterator it = table->iter();
     while (it.next())
@@ -85,7 +96,7 @@ void GarbageCollector::scan(Table *table)
         this->value(value);
     }
 }
-void GarbageCollector::scan(Hook *hook)
+void Marker::scan(Hook *hook)
 {
     if (hook->is_detached)
     {
@@ -104,6 +115,7 @@ void GarbageCollector::scan(Hook *hook)
 }
 void GarbageCollector::scan()
 {
+    Marker *m = &this->marker;
     Frame *frame = rt->topframe();
     while (frame)
     {
@@ -112,12 +124,12 @@ void GarbageCollector::scan()
 #ifdef GC_DEBUG
             inspector.label("frame error");
 #endif
-            this->value(frame->error);
+            m->value(frame->error);
         }
 #ifdef GC_DEBUG
         inspector.label("frame function");
 #endif
-        this->value(frame->fn);
+        m->value(frame->fn);
         for (size_t i = 0; i < frame->hookptr; i++)
         {
             Hook *hook = frame->hooktable()[i];
@@ -126,7 +138,7 @@ void GarbageCollector::scan()
 #ifdef GC_DEBUG
                 inspector.label("hook lifo");
 #endif
-                this->reference(hook);
+                m->reference(hook);
             }
         }
         for (size_t i = 0; i < frame->sp; i++)
@@ -134,7 +146,7 @@ void GarbageCollector::scan()
 #ifdef GC_DEBUG
             inspector.label("stack value");
 #endif
-            this->value(frame->stack()[i]);
+            m->value(frame->stack()[i]);
         }
         frame = frame->prev;
     }
@@ -142,82 +154,361 @@ void GarbageCollector::scan()
 #ifdef GC_DEBUG
     inspector.label("gobal table");
 #endif
-    this->value(rt->table_global());
+    m->value(rt->table_global());
 }
-void GarbageCollector::mark()
+void GarbageCollector::start()
 {
 #ifdef GC_DEBUG
     inspector.init();
 #endif
+    this->forget();
+    this->young.truncate(0);
+    this->rt->arena->clear_marks();
+    for (large_header_t *node = this->rt->large; node; node = node->next)
+        ((gc_header_t *)(node + 1))->marked = false;
+    this->phase = GCPhase::GCMark;
+    this->rt->marking = true;
     this->scan();
-    while (this->scanlifo->alloc_type != AllocType::ATDummy)
+}
+size_t GarbageCollector::propagate(size_t budget)
+{
+#ifndef GC_DEBUG
+    size_t threads = this->rt->gc_threads;
+    if (budget == SIZE_MAX && threads > 1 && this->rt->allocated >= GC_PARALLEL_HEAP)
+    {
+        this->parallel_propagate(threads);
+        return 0;
+    }
+#endif
+    size_t work = 0;
+    while (work < budget && !this->marker.stack.empty())
     {
-        gc_header_t *obj = this->scanlifo;
-        this->scanlifo = obj->scan;
-        this->scan(obj);
+        this->marker.scan(this->marker.stack.pop());
+        work++;
     }
+    return work;
 }
-void GarbageCollector::value(LuaValue val)
+// a marker out of work steals from its own shared stack and then from the
+// others. it counts itself idle while none of them has anything to steal,
+// the marking is over once all the markers are idle: a marker only shares
+// while it is busy, so they cannot be idle with work left
+static void parallel_mark(Marker *markers, size_t count, size_t self, std::atomic<size_t> *idle)
 {
-    if (val.kind == LuaType::LVString)
-        this->reference(((lstr_p)val.data.ptr) - 1);
-    else if (is_obj(val))
+    Marker *m = &markers[self];
+    for (;;)
     {
-        this->reference(val.data.ptr);
+        m->drain();
+        bool stolen = false;
+        for (size_t i = 0; i < count && !stolen; i++)
+            stolen = m->steal(&markers[(self + i) % count]);
+        if (stolen)
+            continue;
+        idle->fetch_add(1);
+        for (;;)
+        {
+            if (idle->load() == count)
+                return;
+            bool available = false;
+            for (size_t i = 0; i < count && !available; i++)
+                available = markers[i].sharing();
+            if (available)
+            {
+                idle->fetch_sub(1);
+                break;
+            }
+            std::this_thread::yield();
+        }
     }
 }
-void GarbageCollector::reference(void *ptr)
+void GarbageCollector::parallel_propagate(size_t threads)
+{
+    Marker *markers = new Marker[threads];
+    HeaderStack &gray = this->marker.stack;
+    for (size_t i = 0; i < gray.size(); i++)
+        markers[i % threads].stack.push(gray[i]);
+    gray.truncate(0);
+    std::atomic<size_t> idle(0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++)
+        markers[i].atomic = true;
+    for (size_t i = 1; i < threads; i++)
+        workers.emplace_back(parallel_mark, markers, threads, i, &idle);
+    parallel_mark(markers, threads, 0, &idle);
+    for (std::thread &worker : workers)
+        worker.join();
+    delete[] markers;
+}
+// the stack changed under the marking without barriers, scanning the roots
+// again and everything they reach makes the marking complete
+void GarbageCollector::finish_mark()
+{
+    this->scan();
+    this->propagate(SIZE_MAX);
+    this->rt->marking = false;
+    this->phase = GCPhase::GCSweep;
+    this->page_cursor = this->rt->arena->first_page();
+    this->large_cursor = this->rt->large;
+}
+void Marker::value(LuaValue val)
+{
+    if (!is_obj(val))
+        return;
+    this->reference(value_header(val) + 1);
+}
+void GarbageCollector::shade(LuaValue val)
+{
+#ifdef GC_DEBUG
+    inspector.label("write barrier");
+#endif
+    this->marker.value(val);
+}
+void GarbageCollector::barrier(gc_header_t *obj, LuaValue val)
+{
+    if (this->phase == GCPhase::GCMark)
+        this->shade(val);
+    else if (obj->age == GC_PROMOTE_AGE && !obj->remembered && value_header(val)->age < GC_PROMOTE_AGE)
+        this->remember(obj);
+}
+void GarbageCollector::remember(gc_header_t *obj)
+{
+    obj->remembered = true;
+    this->remembered.push(obj);
+}
+void GarbageCollector::forget()
+{
+    for (size_t i = 0; i < this->remembered.size(); i++)
+        this->remembered[i]->remembered = false;
+    this->remembered.truncate(0);
+}
+void GarbageCollector::revive(gc_header_t *obj)
+{
+    if (this->phase == GCPhase::GCSweep)
+        Marker::set_mark(obj);
+}
+void Marker::reference(void *ptr)
 {
     gc_header_t *header = ((gc_header_t *)ptr) - 1;
 #ifdef GC_DEBUG
-    inspector.child(ptr, header->alloc_type, !header->marked);
+    inspector.child(ptr, header->alloc_type, !is_marked(header));
 #endif
-    if (header->marked)
-        return;
-    header->marked = true;
-    header->scan = this->scanlifo;
-    this->scanlifo = header;
+    if (this->young_only)
+    {
+        if (header->age == GC_PROMOTE_AGE)
+            return;
+        if (header->age + 1 < GC_PROMOTE_AGE)
+            this->young_child = true;
+    }
+    if (this->atomic)
+    {
+        // another marker may be setting the same bit
+        bool was_marked;
+        if (header->size_class)
+            was_marked = Arena::test_and_mark(header);
+        else
+            was_marked = __atomic_exchange_n(&header->marked, true, __ATOMIC_RELAXED);
+        if (was_marked)
+            return;
+    }
+    else
+    {
+        if (is_marked(header))
+            return;
+        set_mark(header);
+    }
+    this->stack.push(header);
 }
-GarbageCollector::GarbageCollector()
+void Marker::drain()
 {
-    this->rt = nullptr;
-    this->dummy.scan =
-        this->dummy.next =
-            this->dummy.prev = nullptr;
-
-    this->dummy.marked = true;
-    this->dummy.alloc_type = AllocType::ATDummy;
-    this->scanlifo = &this->dummy;
+    while (!this->stack.empty())
+    {
+        this->scan(this->stack.pop());
+        if (this->stack.size() > GC_SHARE_SIZE && !this->sharing())
+            this->share();
+    }
 }
-void GarbageCollector::sweep()
+void Marker::share()
 {
-    gc_header_t *hdptr = this->rt->gc_headers()->next;
-    while (hdptr->alloc_type != AllocType::ATDummy)
+    std::lock_guard<std::mutex> guard(this->lock);
+    size_t half = this->stack.size() / 2;
+    for (size_t i = 0; i < half; i++)
+        this->shared.push(this->stack.pop());
+    this->available.store(this->shared.size(), std::memory_order_relaxed);
+}
+bool Marker::steal(Marker *victim)
+{
+    if (!victim->sharing())
+        return false;
+    std::lock_guard<std::mutex> guard(victim->lock);
+    size_t count = (victim->shared.size() + 1) / 2;
+    for (size_t i = 0; i < count; i++)
+        this->stack.push(victim->shared.pop());
+    victim->available.store(victim->shared.size(), std::memory_order_relaxed);
+    return count > 0;
+}
+Marker::Marker() : available(0)
+{
+    this->atomic = false;
+    this->young_only = false;
+    this->young_child = false;
+}
+GarbageCollector::GarbageCollector(LuaRuntime *rt)
+{
+    this->rt = rt;
+    this->page_cursor = nullptr;
+    this->large_cursor = nullptr;
+    this->phase = GCPhase::GCIdle;
+}
+void GarbageCollector::sweep(gc_header_t *obj)
+{
+    if (Marker::is_marked(obj))
+    {
+#ifdef GC_DEBUG
+        inspector.keep(obj + 1);
+#endif
+        obj->age = GC_PROMOTE_AGE;
+    }
+    else
+    {
+#ifdef GC_DEBUG
+        inspector.dealloc(obj + 1, obj->alloc_type);
+#endif
+        this->rt->deallocate(obj);
+    }
+}
+// a step sweeps whole pages, pages mapped and objects allocated since the
+// sweep started are in front of the cursors
+size_t GarbageCollector::sweep(size_t budget)
+{
+    size_t work = 0;
+    while (work < budget && this->page_cursor)
     {
-        gc_header_t *next = hdptr->next;
-        if (hdptr->marked)
+        ArenaPage *page = this->page_cursor;
+        this->page_cursor = page->all_next;
+        if (page->live == 0)
+            continue;
+        for (char *slot = page->first(); slot < page->unused; slot += page->slot)
+        {
+            if (*(uint8_t *)slot == ARENA_FREE)
+                continue;
+            this->sweep((gc_header_t *)slot);
+            work++;
+        }
+    }
+    while (work < budget && this->large_cursor)
+    {
+        large_header_t *node = this->large_cursor;
+        this->large_cursor = node->next;
+        this->sweep((gc_header_t *)(node + 1));
+        work++;
+    }
+    if (!this->page_cursor && !this->large_cursor)
+    {
+        this->phase = GCPhase::GCIdle;
+        this->rt->arena->trim();
+    }
+    return work;
+}
+// scans an object that is old after this collection, it is remembered
+// when it points to objects that stay young
+void GarbageCollector::scan_old(gc_header_t *obj)
+{
+    this->marker.young_child = false;
+    this->marker.scan(obj);
+    if (this->marker.young_child)
+        this->remember(obj);
+}
+void GarbageCollector::minor_sweep()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < this->young.size(); i++)
+    {
+        gc_header_t *obj = this->young[i];
+        if (Marker::is_marked(obj))
         {
-
 #ifdef GC_DEBUG
-            inspector.keep(hdptr + 1);
+            inspector.keep(obj + 1);
 #endif
-            hdptr->marked = false;
+            Marker::clear_mark(obj);
+            if (++obj->age < GC_PROMOTE_AGE)
+                this->young[kept++] = obj;
         }
         else
         {
 #ifdef GC_DEBUG
-            inspector.dealloc(hdptr + 1, hdptr->alloc_type);
+            inspector.dealloc(obj + 1, obj->alloc_type);
 #endif
-            this->rt->deallocate(hdptr);
+            this->rt->deallocate(obj);
         }
-        hdptr = next;
     }
+    this->young.truncate(kept);
+    this->rt->arena->trim();
+}
+void GarbageCollector::minor()
+{
+#ifdef GC_DEBUG
+    inspector.init();
+#endif
+    this->marker.young_only = true;
+    HeaderStack roots;
+    roots.swap(this->remembered);
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        roots[i]->remembered = false;
+        this->scan_old(roots[i]);
+    }
+    this->scan();
+    while (!this->marker.stack.empty())
+    {
+        gc_header_t *obj = this->marker.stack.pop();
+        if (obj->age + 1 == GC_PROMOTE_AGE)
+            this->scan_old(obj);
+        else
+            this->marker.scan(obj);
+    }
+    this->marker.young_only = false;
+    this->minor_sweep();
 }
 
-void GarbageCollector::run(LuaRuntime *rt)
+bool GarbageCollector::step(size_t budget)
 {
-    this->rt = rt;
-    this->mark();
-    this->sweep();
-    this->rt = nullptr;
-}
\ No newline at end of file
+    if (this->phase == GCPhase::GCIdle)
+        this->start();
+    if (this->phase == GCPhase::GCMark)
+    {
+        budget -= this->propagate(budget);
+        if (!this->marker.stack.empty())
+            return false;
+        this->finish_mark();
+    }
+    this->sweep(budget);
+    return this->phase == GCPhase::GCIdle;
+}
+void GarbageCollector::run()
+{
+    if (this->phase != GCPhase::GCIdle)
+        while (!this->step(SIZE_MAX))
+            ;
+    this->step(SIZE_MAX);
+}
+
+HeaderStack::HeaderStack()
+{
+    this->items = nullptr;
+    this->count = 0;
+    this->cap = 0;
+}
+HeaderStack::~HeaderStack()
+{
+    free(this->items);
+}
+void HeaderStack::grow()
+{
+    this->cap = this->cap ? this->cap * 2 : 256;
+    this->items = (gc_header_t **)realloc(this->items, this->cap * sizeof(gc_header_t *));
+}
+void HeaderStack::swap(HeaderStack &other)
+{
+    std::swap(this->items, other.items);
+    std::swap(this->count, other.count);
+    std::swap(this->cap, other.cap);
+}
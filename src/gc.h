@@ -3,15 +3,123 @@
 
 #include "runtime.h"
 #include "table.h"
+#include "arena.h"
+#include <atomic>
+#include <mutex>
+
+// objects marked or swept by one incremental step
+#define GC_STEP_WORK 512
+// bytes the mutator allocates between two incremental steps. every object
+// takes at least 16 bytes, so a step does at least twice the work the
+// allocations since the last one made
+#define GC_STEP_SIZE 4096
+// minor collections an object survives before it is old
+#define GC_PROMOTE_AGE 2
+// bytes the mutator allocates between two minor collections
+#define GC_NURSERY_SIZE (256 * 1024)
+// smaller heaps are marked by a single thread, starting the others would
+// take longer than the marking
+#define GC_PARALLEL_HEAP (8 * 1024 * 1024)
+// a marker holding more gray objects lets the others steal half of them
+#define GC_SHARE_SIZE 64
 
 namespace luayed
 {
-    class GarbageCollector : public IGarbageCollector
+    enum GCPhase
     {
-        LuaRuntime *rt;
-        gc_header_t *scanlifo;
-        gc_header_t dummy;
+        GCIdle,
+        GCMark,
+        GCSweep,
+    };
+
+    // growable array of headers for the work lists of the collector,
+    // outside of the heap it collects
+    class HeaderStack
+    {
+    private:
+        gc_header_t **items;
+        size_t count;
+        size_t cap;
+
+        void grow();
+
+    public:
+        HeaderStack();
+        ~HeaderStack();
+        void push(gc_header_t *obj)
+        {
+            if (this->count == this->cap)
+                this->grow();
+            this->items[this->count++] = obj;
+        }
+        gc_header_t *pop()
+        {
+            return this->items[--this->count];
+        }
+        bool empty() const
+        {
+            return this->count == 0;
+        }
+        size_t size() const
+        {
+            return this->count;
+        }
+        gc_header_t *&operator[](size_t idx)
+        {
+            return this->items[idx];
+        }
+        // keeps the first count items
+        void truncate(size_t count)
+        {
+            this->count = count;
+        }
+        void swap(HeaderStack &other);
+    };
+
+    // Traces the objects popped from its mark stack, marking and pushing
+    // the white ones they point to. The collector has one for its own
+    // marking; a parallel mark runs one per thread, setting the mark bits
+    // atomically so that only one thread pushes each object. A marker with
+    // many gray objects moves half of them to its shared stack, where the
+    // markers that ran out of work steal from.
+    class Marker final : public IGarbageCollector
+    {
+    private:
+        HeaderStack stack;
+        HeaderStack shared;
+        std::mutex lock;
+        std::atomic<size_t> available;
+        bool atomic;
+
+        void share();
+
+        friend class GarbageCollector;
+
+    public:
+        // minor collections only follow young objects, young_child tells
+        // whether the objects scanned point to some that stay young
+        bool young_only;
+        bool young_child;
 
+        Marker();
+        static bool is_marked(gc_header_t *obj)
+        {
+            return obj->size_class ? Arena::marked(obj) : __atomic_load_n(&obj->marked, __ATOMIC_RELAXED);
+        }
+        static void set_mark(gc_header_t *obj)
+        {
+            if (obj->size_class)
+                Arena::mark(obj);
+            else
+                obj->marked = true;
+        }
+        static void clear_mark(gc_header_t *obj)
+        {
+            if (obj->size_class)
+                Arena::unmark(obj);
+            else
+                obj->marked = false;
+        }
         void scan(gc_header_t *obj);
         void scan(Hook *hook);
         void scan(Table *table);
@@ -19,14 +127,93 @@ namespace luayed
         void scan(LuaFunction *fn);
         void scan(Lfunction *fn);
         void reference(void *ptr);
+        // scans until the mark stack is empty
+        void drain();
+        // moves half of the shared stack of victim, which may be this
+        // marker, to the mark stack
+        bool steal(Marker *victim);
+        // true while there is something to steal
+        bool sharing() const
+        {
+            return this->available.load(std::memory_order_relaxed) > 0;
+        }
+    };
+
+    // Tri-color mark and sweep, run to completion or in steps interleaved
+    // with the mutator. White objects are unmarked, gray ones are marked
+    // and wait in the mark stack, black ones are marked and scanned. The
+    // mark bits of objects in the arena are in the bitmaps of their pages,
+    // the ones of larger objects in their header, all are cleared when a
+    // cycle starts. While marking, the runtime shades every value it stores
+    // into an object, so no black object ever points to a white one. Stack
+    // slots are written without a barrier, the roots are scanned once more
+    // before the sweep instead. Objects created while marking start white
+    // and are kept by the roots or the barrier, the ones created while
+    // sweeping start marked. The sweep goes through the arena page by page
+    // and then through the list of large objects.
+    //
+    // In generational mode minor collections only visit young objects,
+    // which are listed as they are allocated. An old object that stores a
+    // young one is remembered and scanned as a root by the next minor
+    // collection, it stays remembered while it points to objects that stay
+    // young. Minor collections clear the marks of the survivors, and a full
+    // collection makes every survivor old.
+    //
+    // With more than one gc thread, marking a large heap to completion is
+    // shared between threads once the roots are scanned: the gray objects
+    // are dealt out to one marker per thread and the markers steal from
+    // each other until all of them are out of work. This includes the
+    // pause that ends an incremental cycle, which marks what is left to
+    // completion, while budgeted incremental steps and minor collections
+    // mark on their own.
+    class GarbageCollector final
+    {
+        LuaRuntime *rt;
+        Marker marker;
+        HeaderStack remembered;
+        HeaderStack young;
+        ArenaPage *page_cursor;
+        large_header_t *large_cursor;
+        GCPhase phase;
+
         void scan();
-        void mark();
-        void sweep();
+        void shade(LuaValue val);
+        void remember(gc_header_t *obj);
+        void forget();
+        void scan_old(gc_header_t *obj);
+        void sweep(gc_header_t *obj);
+        void minor_sweep();
+        void start();
+        size_t propagate(size_t budget);
+        void parallel_propagate(size_t threads);
+        void finish_mark();
+        size_t sweep(size_t budget);
 
     public:
-        GarbageCollector();
-        void run(LuaRuntime *rt);
+        GarbageCollector(LuaRuntime *rt);
+        // a full collection, a cycle in progress is finished first
+        void run();
+        // true when the step finished a cycle
+        bool step(size_t budget);
+        // a collection of the young objects
+        void minor();
+        // obj stores val, called while marking or in generational mode
+        void barrier(gc_header_t *obj, LuaValue val);
+        // an interned string handed out again must outlive the sweep
+        void revive(gc_header_t *obj);
+        GCPhase get_phase() const
+        {
+            return this->phase;
+        }
+        // called for every new object
+        void born(gc_header_t *obj)
+        {
+            if (this->phase == GCPhase::GCSweep)
+                Marker::set_mark(obj);
+            if (this->rt->generational)
+                this->young.push(obj);
+        }
     };
 };
 
-#endif
\ No newline at end of file
+#endif
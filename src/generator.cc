@@ -28,12 +28,35 @@ size_t BaseGenerator::const_number(lnumber num)
     this->current->constants.push_back(to_string(num));
     return idx;
 }
+size_t BaseGenerator::const_integer(linteger num)
+{
+    size_t idx = this->current->constants.size();
+    this->current->constants.push_back(std::to_string(num));
+    return idx;
+}
 size_t BaseGenerator::const_string(const char *str)
 {
     size_t idx = this->current->constants.size();
     this->current->constants.push_back(str);
     return idx;
 }
+size_t BaseGenerator::const_boolean(bool b)
+{
+    size_t idx = this->current->constants.size();
+    this->current->constants.push_back(b ? "true" : "false");
+    return idx;
+}
+size_t BaseGenerator::const_table(const vector<size_t> &fields, size_t narr, size_t nrec)
+{
+    vector<string> &consts = this->current->constants;
+    string tmpl = "{";
+    for (size_t i = 0; i < fields.size(); i += 2)
+        tmpl += (i ? ", [" : "[") + consts[fields[i]] + "] = " + consts[fields[i + 1]];
+    tmpl += "}";
+    size_t idx = consts.size();
+    consts.push_back(tmpl);
+    return idx;
+}
 fidx_t BaseGenerator::pushf()
 {
     FuncTemplate *fnt = new FuncTemplate();
@@ -130,10 +153,26 @@ size_t LuaGenerator::const_number(lnumber num)
 {
     return this->add_const(this->rt->create_number(num));
 }
+size_t LuaGenerator::const_integer(linteger num)
+{
+    return this->add_const(this->rt->create_integer(num));
+}
 size_t LuaGenerator::const_string(const char *str)
 {
     return this->add_const(this->rt->create_string(str));
 }
+size_t LuaGenerator::const_boolean(bool b)
+{
+    return this->add_const(this->rt->create_boolean(b));
+}
+size_t LuaGenerator::const_table(const vector<size_t> &fields, size_t narr, size_t nrec)
+{
+    vector<LuaValue> &rodata = this->gfn->rodata;
+    LuaValue t = this->rt->create_table(narr, nrec);
+    for (size_t i = 0; i < fields.size(); i += 2)
+        this->rt->table_set(t, rodata[fields[i]], rodata[fields[i + 1]]);
+    return this->add_const(t);
+}
 size_t LuaGenerator::add_const(LuaValue value)
 {
     size_t idx = this->gfn->rodata.size();
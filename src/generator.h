@@ -32,7 +32,10 @@ namespace luayed
         size_t len();
         void debug_info(size_t line);
         size_t const_number(lnumber num);
+        size_t const_integer(linteger num);
         size_t const_string(const char *str);
+        size_t const_boolean(bool b);
+        size_t const_table(const vector<size_t> &fields, size_t narr, size_t nrec);
         fidx_t pushf();
         void popf();
         size_t upval(Upvalue upvalue);
@@ -55,7 +58,10 @@ namespace luayed
         void emit(Bytecode opcode);
         size_t len();
         size_t const_number(lnumber num);
+        size_t const_integer(linteger num);
         size_t const_string(const char *str);
+        size_t const_boolean(bool b);
+        size_t const_table(const vector<size_t> &fields, size_t narr, size_t nrec);
         void debug_info(size_t line);
 
         fidx_t pushf();
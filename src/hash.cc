@@ -1,16 +1,76 @@
 #include "hash.h"
+#include <chrono>
+#include <cstring>
 
-uint32_t luayed::adler32(const void *buf, size_t buflength)
-{
-    const uint8_t *buffer = (const uint8_t *)buf;
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+
+using namespace luayed;
 
-    uint32_t s1 = 1;
-    uint32_t s2 = 0;
+// folds the 128 bit product of a and b into 64 bits
+static inline uint64_t mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+    uint64_t lo = (mid << 32) | (uint32_t)ll;
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+    return lo ^ hi;
+#endif
+}
+static inline uint64_t read8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+static inline uint64_t read4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
 
-    for (size_t n = 0; n < buflength; n++)
+// wyhash style: 16 bytes per multiplication, short strings read with
+// overlapping loads instead of a byte loop
+uint64_t luayed::hash_bytes(const void *buf, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    uint64_t a, b;
+    seed ^= mum(seed ^ HASH_P0, HASH_P1);
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            size_t mid = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + mid);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
     {
-        s1 = (s1 + buffer[n]) % 65521;
-        s2 = (s2 + s1) % 65521;
+        size_t i = len;
+        for (; i > 16; i -= 16, p += 16)
+            seed = mum(read8(p) ^ HASH_P1, read8(p + 8) ^ seed);
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
     }
-    return (s2 << 16) | s1;
-}
\ No newline at end of file
+    return mum(HASH_P1 ^ len, mum(a ^ HASH_P1, b ^ seed));
+}
+
+uint64_t luayed::hash_seed(const void *salt)
+{
+    uint64_t t = std::chrono::steady_clock::now().time_since_epoch().count();
+    return hash_mix(t ^ hash_mix((uintptr_t)salt));
+}
@@ -6,7 +6,20 @@
 
 namespace luayed
 {
-    uint32_t adler32(const void *buf, size_t buflength);
+    // spreads the bits of a word over the whole word, for keys that are
+    // already words: integers, float bit patterns and pointers
+    inline uint64_t hash_mix(uint64_t x)
+    {
+        x ^= x >> 32;
+        x *= 0xd6e8feb86659fd93ull;
+        return x ^ (x >> 32);
+    }
+
+    // hashes a byte string, the seed keeps the hashes of strings picked by
+    // a script from being known in advance
+    uint64_t hash_bytes(const void *buf, size_t len, uint64_t seed);
+    // a seed that differs between runs
+    uint64_t hash_seed(const void *salt);
 };
 
-#endif
\ No newline at end of file
+#endif
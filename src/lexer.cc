@@ -439,10 +439,14 @@ Token Lexer::number(char c)
     else
     {
         RET(this->integer());
+        size_t whole = this->pos;
         RET(this->decimal());
         RET(this->power());
+        // a fraction or an exponent makes the constant a float
+        if (c == '.' || this->pos != whole)
+            return this->token(TokenKind::Number);
     }
-    return this->token(TokenKind::Number);
+    return this->token(TokenKind::Integer);
 }
 
 Token Lexer::error(Lerror err)
@@ -102,6 +102,8 @@ string luayed::to_string(const TokenKind &tk)
         return "not equal";
     if (tk == TokenKind::Number)
         return "number";
+    if (tk == TokenKind::Integer)
+        return "integer";
     if (tk == TokenKind::Or)
         return "or";
     if (tk == TokenKind::Plus)
@@ -246,6 +248,7 @@ string luayed::to_string(const Opcode &opcode)
     opnames[ITGet] = "tget";
     opnames[ITSet] = "tset";
     opnames[ITNew] = "tnew";
+    opnames[ITClone] = "tclone";
     opnames[IGGet] = "gget";
     opnames[IGSet] = "gset";
     opnames[INil] = "nil";
@@ -256,6 +259,11 @@ string luayed::to_string(const Opcode &opcode)
     opnames[IRet] = "ret";
     opnames[IJmp] = "jmp";
     opnames[ICjmp] = "cjmp";
+    opnames[IFjmp] = "fjmp";
+    opnames[IAndJmp] = "andjmp";
+    opnames[IOrJmp] = "orjmp";
+    opnames[IForPrep] = "forprep";
+    opnames[IForLoop] = "forloop";
     opnames[ICall] = "call";
     opnames[IVargs] = "vargs";
     opnames[ITList] = "tlist";
@@ -270,6 +278,48 @@ string luayed::to_string(const Opcode &opcode)
     opnames[IUpvalue] = "upvalue";
     opnames[IUStore] = "ustore";
     opnames[IPop] = "pop";
+    opnames[IRAdd] = "radd";
+    opnames[IRSub] = "rsub";
+    opnames[IRMult] = "rmult";
+    opnames[IRFlrDiv] = "rflrdiv";
+    opnames[IRFltDiv] = "rfltdiv";
+    opnames[IRMod] = "rmod";
+    opnames[IRPow] = "rpow";
+    opnames[IRMove] = "rmove";
+    opnames[IRJEq] = "rjeq";
+    opnames[IRJNe] = "rjne";
+    opnames[IRJLt] = "rjlt";
+    opnames[IRJLe] = "rjle";
+    opnames[IRJGt] = "rjgt";
+    opnames[IRJGe] = "rjge";
+    opnames[IRJNLt] = "rjnlt";
+    opnames[IRJNLe] = "rjnle";
+    opnames[IRJNGt] = "rjngt";
+    opnames[IRJNGe] = "rjnge";
+    opnames[ITGetK] = "tgetk";
+    opnames[ITSetK] = "tsetk";
+    opnames[ISelf] = "self";
+    opnames[IGGetK] = "ggetk";
+    opnames[IGSetK] = "gsetk";
+    opnames[IAddNN] = "addnn";
+    opnames[ISubNN] = "subnn";
+    opnames[IMultNN] = "multnn";
+    opnames[IFlrDivNN] = "flrdivnn";
+    opnames[IFltDivNN] = "fltdivnn";
+    opnames[IModNN] = "modnn";
+    opnames[IPowNN] = "pownn";
+    opnames[IConcatSS] = "concatss";
+    opnames[IGeNN] = "genn";
+    opnames[IGtNN] = "gtnn";
+    opnames[ILeNN] = "lenn";
+    opnames[ILtNN] = "ltnn";
+    opnames[IRAddNN] = "raddnn";
+    opnames[IRSubNN] = "rsubnn";
+    opnames[IRMultNN] = "rmultnn";
+    opnames[IRFlrDivNN] = "rflrdivnn";
+    opnames[IRFltDivNN] = "rfltdivnn";
+    opnames[IRModNN] = "rmodnn";
+    opnames[IRPowNN] = "rpownn";
     return opnames[opcode];
 }
 string luayed::to_string(const vector<lbyte> &bin)
@@ -295,6 +345,11 @@ string luayed::to_string(const lbyte *text, size_t codelen)
             str.push_back(' ');
             str += std::to_string(ins.oprnd2);
         }
+        if (ins.oprnd_count() > 2)
+        {
+            str.push_back(' ');
+            str += std::to_string(ins.oprnd3);
+        }
         str.push_back('\n');
     }
     return str;
@@ -311,13 +366,13 @@ string luayed::to_string(const LuaValue &lv)
     else if (lv.kind == LuaType::LVNumber)
     {
         s += "(";
-        s += std::to_string(lv.data.n);
+        s += lv.is_int() ? std::to_string((linteger)lv.data.i) : std::to_string(lv.data.n);
         s += ")";
     }
     else if (lv.kind == LuaType::LVString)
     {
         s += "(";
-        s += (const char *)lv.data.ptr;
+        s += lv.str();
         s += ")";
     }
     return s;
@@ -11,10 +11,13 @@
 
 using namespace luayed;
 
-Lua::Lua(LuaConfig conf) : runtime(&this->interpreter)
+Lua::Lua(LuaConfig conf) : runtime(&this->interpreter), config(conf)
 {
     this->runtime.set_lua_interface(this);
     this->interpreter.config_error_metadata(conf.error_metadata);
+    this->runtime.set_incremental_gc(conf.incremental_gc);
+    this->runtime.set_generational_gc(conf.generational_gc);
+    this->runtime.set_gc_threads(conf.gc_threads);
     if (conf.load_stdlib)
         luastd::libinit(this);
 }
@@ -44,6 +47,8 @@ int Lua::compile(const char *lua_code, string &errors, const char *chunkname)
     }
     LuaGenerator gen(&this->runtime);
     Compiler compiler(&gen);
+    compiler.config_register_ops(this->config.register_vm);
+    compiler.config_superinstructions(this->config.superinstructions);
     compiler.compile(ast, lua_code, chunkname);
     this->runtime.push_compiled_bin();
     return LUA_COMPILE_RESULT_OK;
@@ -52,10 +57,18 @@ void Lua::push_number(lnumber num)
 {
     this->runtime.stack_push(this->runtime.create_number(num));
 }
+void Lua::push_integer(linteger num)
+{
+    this->runtime.stack_push(this->runtime.create_integer(num));
+}
 void Lua::push_boolean(bool b)
 {
     this->runtime.stack_push(this->runtime.create_boolean(b));
 }
+void Lua::create_table(size_t narr, size_t nrec)
+{
+    this->runtime.stack_push(this->runtime.create_table(narr, nrec));
+}
 void Lua::insert(size_t index)
 {
     LuaValue v = this->runtime.stack_pop();
@@ -102,7 +115,15 @@ void Lua::pop()
 }
 lnumber Lua::pop_number()
 {
-    return this->runtime.stack_pop().data.n;
+    return this->runtime.stack_pop().number();
+}
+bool Lua::is_int()
+{
+    return this->runtime.stack_back_read(1).is_int();
+}
+linteger Lua::pop_integer()
+{
+    return this->runtime.stack_pop().data.i;
 }
 bool Lua::pop_boolean()
 {
@@ -110,7 +131,7 @@ bool Lua::pop_boolean()
 }
 const char *Lua::peek_string()
 {
-    return this->runtime.stack_back_read(1).as<const char *>();
+    return this->runtime.stack_back_string(1);
 }
 bool Lua::has_error()
 {
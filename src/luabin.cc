@@ -1,4 +1,5 @@
 #include "luabin.h"
+#include <algorithm>
 
 using namespace luayed;
 
@@ -9,11 +10,12 @@ bool luayed::operator==(const Upvalue &l, const Upvalue &r)
 
 Upvalue::Upvalue(fidx_t fidx, size_t offset, size_t hidx) : fidx(fidx), offset(offset), hidx(hidx) {}
 
-Instruction::Instruction(Opcode op, size_t oprnd1, size_t oprnd2)
+Instruction::Instruction(Opcode op, size_t oprnd1, size_t oprnd2, size_t oprnd3)
 {
     this->op = op;
     this->oprnd1 = oprnd1;
     this->oprnd2 = oprnd2;
+    this->oprnd3 = oprnd3;
     this->dbg = 0;
 }
 
@@ -23,10 +25,21 @@ Bytecode luayed::Instruction::encode() const
     lbyte op = this->op;
     bc.count = 1;
     size_t ac = op_oprnd_count(op);
+    if (op_is_register(op))
+    {
+        size_t oprnds[3] = {this->oprnd1, this->oprnd2, this->oprnd3};
+        for (size_t i = 0; i < ac; i++)
+        {
+            bc.bytes[bc.count++] = oprnds[i] % 256;
+            bc.bytes[bc.count++] = oprnds[i] >> 8;
+        }
+        bc.bytes[0] = op;
+        return bc;
+    }
     if (ac >= 1)
     {
 
-        if (this->oprnd1 >= 256 || op == Opcode::IJmp || op == Opcode::ICjmp)
+        if (this->oprnd1 >= 256 || op_is_jump(op))
         {
             op = op | 0x1;
             bc.bytes[bc.count++] = this->oprnd1 % 256;
@@ -58,13 +71,37 @@ size_t luayed::op_oprnd_count(lbyte op)
 {
     if (op < 0x80)
         return 0;
-    op >>= 1;
-    op <<= 1;
-    if (op == Opcode::ICall || op == Opcode::ICall + 2)
+    if (op_is_register(op))
+        return op == Opcode::IRMove ? 2 : 3;
+    op &= ~0x3;
+    if (op == Opcode::ICall || op == Opcode::ITNew)
         return 2;
     return 1;
 }
 
+bool luayed::op_is_jump(lbyte op)
+{
+    if (op >= Opcode::IRJEq && op <= Opcode::IRJNGe)
+        return true;
+    op >>= 1;
+    op <<= 1;
+    return op == Opcode::IJmp || op == Opcode::ICjmp ||
+           op == Opcode::IFjmp || op == Opcode::IAndJmp || op == Opcode::IOrJmp ||
+           op == Opcode::IForPrep || op == Opcode::IForLoop;
+}
+
+bool luayed::op_is_register(lbyte op)
+{
+    return op >= 0x80 && op < 0xc0;
+}
+
+bool luayed::op_has_cache(lbyte op)
+{
+    return op == Opcode::IGGet || op == Opcode::IGSet ||
+           op == Opcode::IGGetK || op == Opcode::IGSetK ||
+           op == Opcode::ITGetK || op == Opcode::ITSetK || op == Opcode::ISelf;
+}
+
 size_t luayed::Instruction::oprnd_count() const
 {
     return op_oprnd_count(this->op);
@@ -82,6 +119,15 @@ Instruction luayed::Instruction::decode(const lbyte *binary, size_t *read_count)
     size_t oprnd1 = 0;
     size_t oprnd2 = 0;
     size_t oprnd_count = op_oprnd_count(op);
+    if (op_is_register(op))
+    {
+        size_t oprnds[3] = {0, 0, 0};
+        for (size_t i = 0; i < oprnd_count; i++, rc += 2)
+            oprnds[i] = binary[rc] + binary[rc + 1] * 256;
+        if (read_count)
+            *read_count = rc;
+        return Instruction((Opcode)op, oprnds[0], oprnds[1], oprnds[2]);
+    }
     if (oprnd_count >= 1)
     {
         oprnd1 = binary[rc++];
@@ -103,4 +149,41 @@ Instruction luayed::Instruction::decode(const lbyte *binary, size_t *read_count)
     if (read_count)
         *read_count = rc;
     return Instruction((Opcode)op, oprnd1, oprnd2);
+}
+
+size_t luayed::predecode(const lbyte *text, size_t codelen, Dinstruction *code, uint32_t *textpos, size_t *cachelen)
+{
+    size_t count = 0;
+    size_t caches = 0;
+    for (size_t i = 0; i < codelen; count++)
+    {
+        size_t rc;
+        Instruction ins = Instruction::decode(text + i, &rc);
+        if (code)
+        {
+            code[count].op = ins.op;
+            code[count].a = ins.oprnd1;
+            code[count].b = ins.oprnd2;
+            code[count].c = ins.oprnd3;
+            textpos[count] = i;
+            if (op_has_cache(ins.op))
+                code[count].b = caches;
+        }
+        if (op_has_cache(ins.op))
+            caches++;
+        i += rc;
+    }
+    if (cachelen)
+        *cachelen = caches;
+    if (!code)
+        return count;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (op_is_jump(code[i].op))
+        {
+            uint32_t *target = std::lower_bound(textpos, textpos + count, code[i].a);
+            code[i].a = target - textpos;
+        }
+    }
+    return count;
 }
\ No newline at end of file
@@ -1,47 +1,71 @@
 #include "runtime.h"
 #include "table.h"
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include "gc.h"
+#include "arena.h"
+#include "hash.h"
+#include "shape.h"
 
 #define LV_AS_FUNC(V) ((LuaFunction *)((V)->data.ptr))
 
 using namespace luayed;
 
-int lstr_compare(const lstr_p &a, const lstr_p &b)
+void Frame::bind(LuaValue fn)
 {
-    return strcmp(a->cstr(), b->cstr());
-}
-hash_t lstr_hash(const lstr_p &a)
-{
-    return a->hash;
+    this->fn = fn;
+    this->lbin = nullptr;
+    this->consts = nullptr;
+    this->direct = SIZE_MAX;
+    if (fn.kind != LuaType::LVNil && fn.as<LuaFunction *>()->is_lua)
+    {
+        this->lbin = fn.as<LuaFunction *>()->binary();
+        this->consts = this->lbin->rodata();
+        this->direct = this->lbin->parcount;
+    }
+    this->base = (LuaValue *)(this->hooktable() + this->hookmax());
 }
-
 bool Frame::is_Lua()
 {
     return ((LuaFunction *)this->fn.data.ptr)->is_lua;
 }
 
-lbyte *Lfunction::text()
+// sections are laid out in decreasing order of alignment:
+// code, rodata, innerfns, ups, dbs, textpos, text
+Dinstruction *Lfunction::code()
 {
-    return (lbyte *)(this + 1);
+    return (Dinstruction *)(this + 1);
 }
-Upvalue *Lfunction::ups()
+InlineCache *Lfunction::icache()
 {
-    return (Upvalue *)(this->innerfns() + this->inlen);
+    return (InlineCache *)(this->code() + this->oplen);
 }
 LuaValue *Lfunction::rodata()
 {
-    return (LuaValue *)(this->text() + this->codelen);
+    return (LuaValue *)(this->icache() + this->iclen);
 }
 Lfunction **Lfunction::innerfns()
 {
     return (Lfunction **)(this->rodata() + this->rolen);
 }
+Upvalue *Lfunction::ups()
+{
+    return (Upvalue *)(this->innerfns() + this->inlen);
+}
 dbginfo_t *Lfunction::dbs()
 {
     return (dbginfo_t *)(this->ups() + this->uplen);
 }
+uint32_t *Lfunction::textpos()
+{
+    return (uint32_t *)(this->dbs() + this->dblen);
+}
+lbyte *Lfunction::text()
+{
+    return (lbyte *)(this->textpos() + this->oplen);
+}
 LuaValue LuaRuntime::create_nil()
 {
     LuaValue val;
@@ -62,6 +86,17 @@ LuaValue LuaRuntime::create_string(const char *s)
     return this->create_string(s, "");
 }
 
+#ifdef LUAYED_NAN_BOXING
+LuaValue LuaRuntime::create_boxed_integer(linteger n)
+{
+    linteger *box = (linteger *)this->allocate(sizeof(linteger), AllocType::ATInteger);
+    *box = n;
+    LuaValue val;
+    val.set_boxed_int(box);
+    return val;
+}
+#endif
+
 LuaValue LuaRuntime::create_string(lnumber n)
 {
     const size_t buffer_size = 64;
@@ -69,26 +104,42 @@ LuaValue LuaRuntime::create_string(lnumber n)
     snprintf(buffer, buffer_size, "%g", n);
     return this->create_string(buffer);
 }
+LuaValue LuaRuntime::create_string(linteger n)
+{
+    const size_t buffer_size = 32;
+    char buffer[buffer_size];
+    snprintf(buffer, buffer_size, "%" PRId64, n);
+    return this->create_string(buffer);
+}
 
+// short strings are kept in the value, only longer ones are interned
 LuaValue LuaRuntime::create_string(const char *s1, const char *s2)
 {
     LuaValue val;
-    val.kind = LuaType::LVString;
-
     size_t slen1 = strlen(s1);
     size_t slen2 = strlen(s2);
+    if (slen1 + slen2 <= SSTR_MAX_LEN)
+    {
+        char chars[SSTR_MAX_LEN];
+        memcpy(chars, s1, slen1);
+        memcpy(chars + slen1, s2, slen2);
+        val.set_sstr(chars, slen1 + slen2);
+        return val;
+    }
+    val.kind = LuaType::LVString;
     size_t strsize = sizeof(lstr_t) + slen1 + slen2 + 1;
     lstr_p str = (lstr_p)this->allocate_raw(strsize);
     strcpy((char *)str->cstr(), s1);
     strcpy((char *)(str->cstr() + slen1), s2);
     *(char *)(str->cstr() + slen1 + slen2) = '\0';
     str->len = slen1 + slen2;
-    str->hash = adler32(str->cstr(), str->len);
+    str->hash = hash_bytes(str->cstr(), str->len, this->seed);
     lstr_p *p = this->lstrset.get(str);
     if (p)
     {
         this->deallocate_raw(str);
         str = *p;
+        this->gc->revive(((gc_header_t *)str) - 1);
     }
     else
     {
@@ -102,12 +153,21 @@ LuaValue LuaRuntime::create_string(const char *s1, const char *s2)
     return val;
 }
 
-LuaValue LuaRuntime::create_table()
+LuaValue LuaRuntime::create_table(size_t narr, size_t nrec)
+{
+    LuaValue val;
+    val.kind = LuaType::LVTable;
+    Table *tp = (Table *)this->allocate(sizeof(Table), AllocType::ATTable);
+    tp->init(this, narr, nrec);
+    val.data.ptr = tp;
+    return val;
+}
+LuaValue LuaRuntime::clone_table(LuaValue t)
 {
     LuaValue val;
     val.kind = LuaType::LVTable;
     Table *tp = (Table *)this->allocate(sizeof(Table), AllocType::ATTable);
-    tp->init(this);
+    tp->init(this, t.as<Table *>());
     val.data.ptr = tp;
     return val;
 }
@@ -130,6 +190,8 @@ void LuaRuntime::table_set(LuaValue t, LuaValue k, LuaValue v)
     if (!this->table_check(t, k, true))
         return;
     Table *tp = t.as<Table *>();
+    this->write_barrier(tp, k);
+    this->write_barrier(tp, v);
     tp->set(k, v);
 }
 LuaValue LuaRuntime::table_get(LuaValue t, LuaValue k)
@@ -142,10 +204,61 @@ LuaValue LuaRuntime::table_get(LuaValue t, LuaValue k)
     LuaValue v = tp->get(k);
     return v;
 }
+size_t LuaRuntime::table_length(LuaValue t)
+{
+    return t.as<Table *>()->length();
+}
 LuaValue LuaRuntime::table_global()
 {
     return this->global;
 }
+LuaValue LuaRuntime::global_get(LuaValue k, size_t ic)
+{
+    GlobalCache *c = &this->frame->lbin->icache()[ic].global;
+    Table *g = this->global.as<Table *>();
+    if (k.kind == LuaType::LVString && c->key == k.data.ptr && c->version == g->version())
+        return c->slot->value;
+    if (k.kind != LuaType::LVString)
+        return this->table_get(this->global, k);
+    TableElement *e = g->find(k);
+    if (!e)
+        return this->create_nil();
+    *c = {k.data.ptr, g->version(), e};
+    return e->value;
+}
+void LuaRuntime::global_set(LuaValue k, LuaValue v, size_t ic)
+{
+    GlobalCache *c = &this->frame->lbin->icache()[ic].global;
+    Table *g = this->global.as<Table *>();
+    bool cached = k.kind == LuaType::LVString && v.kind != LuaType::LVNil;
+    this->write_barrier(g, v);
+    if (cached && c->key == k.data.ptr && c->version == g->version())
+    {
+        c->slot->value = v;
+        return;
+    }
+    if (!this->table_check(this->global, k, true))
+        return;
+    this->write_barrier(g, k);
+    g->set(k, v);
+    if (cached)
+        *c = {k.data.ptr, g->version(), g->find(k)};
+}
+LuaValue LuaRuntime::field_get(LuaValue t, LuaValue k, size_t ic)
+{
+    if (t.kind != LuaType::LVTable)
+        return this->table_get(t, k);
+    return t.as<const Table *>()->get(k, &this->frame->lbin->icache()[ic].field);
+}
+void LuaRuntime::field_set(LuaValue t, LuaValue k, LuaValue v, size_t ic)
+{
+    if (!this->table_check(t, k, true))
+        return;
+    Table *tp = t.as<Table *>();
+    this->write_barrier(tp, k);
+    this->write_barrier(tp, v);
+    tp->set(k, v, &this->frame->lbin->icache()[ic].field);
+}
 
 size_t LuaRuntime::extras()
 {
@@ -155,13 +268,6 @@ size_t LuaRuntime::argcount()
 {
     return this->frame->vargs_count;
 }
-LuaValue LuaRuntime::create_number(lnumber n)
-{
-    LuaValue val;
-    val.kind = LuaType::LVNumber;
-    val.data.n = n;
-    return val;
-}
 void LuaRuntime::set_compiled_bin(Lfunction *bin)
 {
     this->compiled_bin = bin;
@@ -244,7 +350,11 @@ LuaValue LuaRuntime::chunkname()
 
 Lfunction *LuaRuntime::create_binary(GenFunction *gfn)
 {
+    size_t iclen;
+    size_t oplen = predecode(gfn->text.data(), gfn->text.size(), nullptr, nullptr, &iclen);
     size_t bin_size = sizeof(Lfunction) +
+                      oplen * (sizeof(Dinstruction) + sizeof(uint32_t)) +
+                      iclen * sizeof(InlineCache) +
                       gfn->text.size() * sizeof(lbyte) +
                       gfn->rodata.size() * sizeof(LuaValue) +
                       gfn->upvalues.size() * sizeof(Upvalue) +
@@ -257,6 +367,8 @@ Lfunction *LuaRuntime::create_binary(GenFunction *gfn)
     fn->hookmax = gfn->hookmax;
     fn->parcount = gfn->parcount;
     fn->codelen = gfn->text.size();
+    fn->oplen = oplen;
+    fn->iclen = iclen;
     fn->rolen = gfn->rodata.size();
     fn->uplen = gfn->upvalues.size();
     fn->inlen = gfn->innerfns.size();
@@ -273,42 +385,62 @@ Lfunction *LuaRuntime::create_binary(GenFunction *gfn)
         fn->innerfns()[i] = gfn->innerfns[i];
     for (size_t i = 0; i < gfn->dbg_lines.size(); i++)
         fn->dbs()[i] = gfn->dbg_lines[i];
+    predecode(fn->text(), fn->codelen, fn->code(), fn->textpos());
+    memset(fn->icache(), 0, iclen * sizeof(InlineCache));
 
     return fn;
 }
-void LuaRuntime::heap_init()
+void LuaRuntime::collect_garbage()
 {
-    gc_header_t *head = (gc_header_t *)this->allocate_raw(sizeof(gc_header_t));
-    gc_header_t *tail = (gc_header_t *)this->allocate_raw(sizeof(gc_header_t));
-    head->marked = tail->marked = true;
-    head->scan = tail->scan = nullptr;
-    head->next = tail->prev = nullptr;
-    head->alloc_type = tail->alloc_type = AllocType::ATDummy;
-    head->prev = tail;
-    tail->next = head;
-    this->heap_head = head;
-    this->heap_tail = tail;
+    this->gc->run();
 }
-void LuaRuntime::heap_destroy()
+void LuaRuntime::barrier(void *obj, LuaValue v)
 {
-    this->deallocate_raw(this->heap_head);
-    this->deallocate_raw(this->heap_tail);
+    this->gc->barrier(((gc_header_t *)obj) - 1, v);
 }
-void LuaRuntime::collect_garbage()
+void LuaRuntime::set_incremental_gc(bool incremental)
+{
+    this->incremental = incremental;
+}
+void LuaRuntime::set_generational_gc(bool generational)
+{
+    this->generational = generational;
+}
+void LuaRuntime::set_gc_threads(size_t threads)
 {
-    GarbageCollector gc;
-    gc.run(this);
+    this->gc_threads = threads;
 }
-void LuaRuntime::check_garbage_collection()
+// an incremental step runs each time GC_STEP_SIZE more bytes were
+// allocated, once a cycle is over the threshold goes back to the same
+// rule as for a full collection
+void LuaRuntime::run_garbage_collection()
 {
-    if (this->allocated > this->threshold)
+    // minor collections until the heap doubled since the last full one
+    if (this->generational)
     {
-        this->collect_garbage();
-        while (this->allocated > this->threshold)
-            this->threshold *= 2;
-        while (this->allocated < this->threshold / 4 && this->threshold > 1024)
-            this->threshold /= 2;
+        if (this->allocated > this->major_threshold)
+        {
+            this->collect_garbage();
+            this->major_threshold = std::max(this->allocated * 2, (size_t)GC_NURSERY_SIZE);
+        }
+        else
+            this->gc->minor();
+        this->threshold = this->allocated + GC_NURSERY_SIZE;
+        return;
     }
+    if (this->incremental)
+    {
+        if (this->gc->step(GC_STEP_WORK))
+            this->threshold = std::max(this->allocated * 2, (size_t)1024);
+        else
+            this->threshold = this->allocated + GC_STEP_SIZE;
+        return;
+    }
+    this->collect_garbage();
+    while (this->allocated > this->threshold)
+        this->threshold *= 2;
+    while (this->allocated < this->threshold / 4 && this->threshold > 1024)
+        this->threshold /= 2;
 }
 void *LuaRuntime::allocate_raw(size_t size)
 {
@@ -317,27 +449,47 @@ void *LuaRuntime::allocate_raw(size_t size)
     *ptr = size;
     return ptr + 1;
 }
-void LuaRuntime::heap_insert(gc_header_t *node, gc_header_t *prev, gc_header_t *next)
+void LuaRuntime::large_insert(large_header_t *node)
 {
-    prev->next = node;
-    next->prev = node;
-    node->prev = prev;
-    node->next = next;
+    node->prev = nullptr;
+    node->next = this->large;
+    if (this->large)
+        this->large->prev = node;
+    this->large = node;
 }
-void LuaRuntime::heap_remove(gc_header_t *node)
+void LuaRuntime::large_remove(large_header_t *node)
 {
-    gc_header_t *prev = node->prev;
-    gc_header_t *next = node->next;
-    next->prev = prev;
-    prev->next = next;
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        this->large = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
 }
+static_assert(sizeof(gc_header_t) == 8, "the gc header is a single word");
+// small objects go to the arena, its slots have no size prefix
 void *LuaRuntime::allocate(size_t size, AllocType at)
 {
-    gc_header_t *obj = (gc_header_t *)this->allocate_raw(size + sizeof(gc_header_t));
-    obj->marked = false;
-    obj->scan = nullptr;
+    size += sizeof(gc_header_t);
+    gc_header_t *obj;
+    if (size <= ARENA_MAX_SIZE)
+    {
+        obj = (gc_header_t *)this->arena->allocate(size);
+        obj->size_class = Arena::size(obj) / ARENA_GRANULE;
+        this->allocated += Arena::size(obj);
+    }
+    else
+    {
+        large_header_t *node = (large_header_t *)this->allocate_raw(sizeof(large_header_t) + size);
+        this->large_insert(node);
+        obj = (gc_header_t *)(node + 1);
+        obj->size_class = 0;
+    }
     obj->alloc_type = at;
-    this->heap_insert(obj, this->heap_tail, this->heap_tail->next);
+    obj->age = 0;
+    obj->remembered = false;
+    obj->marked = false;
+    this->gc->born(obj);
     return obj + 1;
 }
 void LuaRuntime::deallocate_raw(void *ptr)
@@ -362,7 +514,7 @@ void LuaRuntime::new_frame()
     frame->sp = 0;
     frame->ip = 0;
     frame->ret_count = 0;
-    frame->fn = this->create_nil();
+    frame->bind(this->create_nil());
     frame->has_error = false;
     frame->error = this->create_nil();
     this->frame = frame;
@@ -370,29 +522,43 @@ void LuaRuntime::new_frame()
 LuaRuntime::LuaRuntime(IInterpreter *interpreter) : interpreter(interpreter)
 {
     this->frame = nullptr;
-    this->heap_init();
+    this->arena = new Arena();
+    this->gc = new GarbageCollector(this);
     this->stack_buffer = this->allocate_raw(STACK_BUFFER_SIZE);
-    this->lstrset.init(lstr_compare, lstr_hash, this);
+    this->seed = hash_seed(this);
+    this->lstrset.init(this);
+    this->shapes = Shape::create_root(this);
     this->func_count = 0;
     this->new_frame();
     this->global = this->create_table();
+    // the global caches point into the hash set
+    this->global.as<Table *>()->make_dictionary();
 }
 LuaRuntime::~LuaRuntime()
 {
     this->frame = nullptr;
     this->global = this->create_nil();
     this->collect_garbage();
-    this->heap_destroy();
+    delete this->gc;
+    delete this->arena;
     this->deallocate_raw(this->stack_buffer);
     this->lstrset.destroy();
+    Shape::destroy(this->shapes, this);
+}
+GarbageCollector *LuaRuntime::collector()
+{
+    return this->gc;
+}
+ArenaStats LuaRuntime::arena_stats()
+{
+    return this->arena->stats();
 }
-gc_header_t *LuaRuntime::gc_headers()
+Shape *LuaRuntime::shape_root()
 {
-    return this->heap_tail;
+    return this->shapes;
 }
 void LuaRuntime::deallocate(gc_header_t *hdr)
 {
-    this->heap_remove(hdr);
     if (hdr->alloc_type == AllocType::ATTable)
     {
         ((Table *)(hdr + 1))->destroy();
@@ -402,7 +568,17 @@ void LuaRuntime::deallocate(gc_header_t *hdr)
         lstr_p str = (lstr_p)(hdr + 1);
         this->lstrset.remove(str);
     }
-    this->deallocate_raw(hdr);
+    if (hdr->size_class)
+    {
+        this->allocated -= hdr->size_class * ARENA_GRANULE;
+        this->arena->deallocate(hdr);
+    }
+    else
+    {
+        large_header_t *node = ((large_header_t *)hdr) - 1;
+        this->large_remove(node);
+        this->deallocate_raw(node);
+    }
 }
 
 void LuaRuntime::copy_values(
@@ -437,16 +613,16 @@ void LuaRuntime::set_lua_interface(void *lua_interface)
 }
 LuaValue LuaRuntime::concat(LuaValue v1, LuaValue v2)
 {
-    return this->create_string(v1.as<const char *>(), v2.as<const char *>());
+    return this->create_string(v1.str(), v2.str());
 }
 LuaValue LuaRuntime::error_to_string(Lerror error)
 {
     if (error.kind == Lerror::LE_NotEnoughArgs)
     {
         LuaValue s1 = this->create_string("expected ");
-        LuaValue s2 = this->create_string(error.as.not_enough_args.expected);
+        LuaValue s2 = this->create_string((linteger)error.as.not_enough_args.expected);
         LuaValue s3 = this->create_string(" values, while there are ");
-        LuaValue s4 = this->create_string(error.as.not_enough_args.available);
+        LuaValue s4 = this->create_string((linteger)error.as.not_enough_args.available);
         LuaValue s5 = this->create_string(" on the stack");
         LuaValue s = s1;
         s = this->concat(s, s2);
@@ -544,7 +720,7 @@ Fnresult LuaRuntime::fncall(size_t argc, size_t retc, bool is_tail)
         // create new frame
         this->new_frame();
         Frame *frame = this->frame;
-        frame->fn = *fn;
+        frame->bind(*fn);
         frame->exp_count = retc;
         frame->vargs_count = 0;
         // move values between frames
@@ -568,7 +744,7 @@ Fnresult LuaRuntime::fncall(size_t argc, size_t retc, bool is_tail)
             this->hookpop();
         frame->ip = 0;
         LuaValue *old_stack = frame->stack();
-        frame->fn = *fn;
+        frame->bind(*fn);
         for (size_t i = 0; i < total_argc; i++)
         {
             frame->stack()[i] = old_stack[frame->sp - total_argc + i];
@@ -684,25 +860,15 @@ LuaRTCppFunction LuaFunction::native()
 
 size_t Frame::parcount()
 {
-    if (this->fn.kind == LuaType::LVNil)
-        return 0;
-    LuaFunction *fn = this->fn.as<LuaFunction *>();
-    return fn->is_lua ? fn->binary()->parcount : 0;
+    return this->lbin ? this->lbin->parcount : 0;
 }
 size_t Frame::hookmax()
 {
-    if (this->fn.kind == LuaType::LVNil)
-        return 0;
-    LuaFunction *fn = this->fn.as<LuaFunction *>();
-    return fn->is_lua ? fn->binary()->hookmax : 0;
+    return this->lbin ? this->lbin->hookmax : 0;
 }
 Lfunction *Frame::bin()
 {
-    return (Lfunction *)this->fn.as<LuaFunction *>()->binary();
-}
-LuaValue *Frame::stack()
-{
-    return (LuaValue *)(this->hooktable() + this->hookmax());
+    return this->lbin;
 }
 LuaValue *Frame::vargs()
 {
@@ -732,30 +898,6 @@ Hook **Frame::hooktable()
 {
     return (Hook **)(this + 1);
 }
-LuaValue LuaRuntime::stack_read(size_t idx)
-{
-    size_t real_idx = this->frame->stack_address(idx);
-    return this->frame->stack()[real_idx];
-}
-size_t Frame::stack_address(size_t idx)
-{
-    return idx < this->bin()->parcount ? idx : (idx + this->vargs_count);
-}
-void LuaRuntime::stack_write(size_t idx, LuaValue value)
-{
-    size_t real_idx = this->frame->stack_address(idx);
-    this->frame->stack()[real_idx] = value;
-}
-LuaValue LuaRuntime::stack_pop()
-{
-    this->frame->sp--;
-    return this->frame->stack()[this->frame->sp];
-}
-void LuaRuntime::stack_push(LuaValue value)
-{
-    this->frame->stack()[this->frame->sp] = value;
-    this->frame->sp++;
-}
 void LuaRuntime::hookpush()
 {
     this->hooktable()[this->frame->hookptr++] = nullptr;
@@ -768,19 +910,10 @@ void LuaRuntime::hookpop()
     {
         hook->is_detached = true;
         hook->val = *hook->original;
+        this->write_barrier(hook, hook->val);
         *ptr = nullptr;
     }
 }
-LuaValue LuaRuntime::stack_back_read(size_t idx)
-{
-    idx = this->stack_size() - idx;
-    return this->frame->stack()[idx];
-}
-void LuaRuntime::stack_back_write(size_t idx, LuaValue value)
-{
-    idx = this->stack_size() - idx;
-    this->frame->stack()[idx] = value;
-}
 LuaValue LuaRuntime::arg(size_t idx)
 {
     if (idx >= this->frame->vargcount())
@@ -796,14 +929,18 @@ fidx_t LuaRuntime::gen_fidx()
 {
     return this->func_count++;
 }
-LuaValue LuaRuntime::rodata(size_t idx)
-{
-    return this->bin()->rodata()[idx];
-}
 lbyte *LuaRuntime::text()
 {
     return this->bin()->text();
 }
+Dinstruction *LuaRuntime::code()
+{
+    return this->bin()->code();
+}
+uint32_t *LuaRuntime::textpos()
+{
+    return this->bin()->textpos();
+}
 dbginfo_t *LuaRuntime::dbgmd()
 {
     return this->bin()->dbs();
@@ -828,16 +965,14 @@ void LuaRuntime::remove_error()
     this->frame->has_error_meta = false;
     this->frame->error = this->create_nil();
 }
-size_t LuaRuntime::stack_size()
-{
-    return this->frame->sp;
-}
 void LuaRuntime::extras(size_t count)
 {
     this->frame->ret_count = count;
 }
-size_t LuaRuntime::length(const char *str)
+size_t LuaRuntime::length(LuaValue s)
 {
-    lstr_p header = ((lstr_p)str) - 1;
+    if (s.is_sstr())
+        return strlen(s.str());
+    lstr_p header = s.as<lstr_p>() - 1;
     return header->len;
 }
@@ -0,0 +1,50 @@
+#include "shape.h"
+#include <string.h>
+
+using namespace luayed;
+
+Shape *Shape::create(IAllocator *allocator, Shape *root, size_t count)
+{
+    Shape *shape = (Shape *)allocator->allocate_raw(sizeof(Shape) + count * sizeof(const void *));
+    shape->root = root ? root : shape;
+    shape->children = nullptr;
+    shape->sibling = nullptr;
+    shape->count = count;
+    shape->transitions = 0;
+    shape->total = 1;
+    return shape;
+}
+Shape *Shape::create_root(IAllocator *allocator)
+{
+    return Shape::create(allocator, nullptr, 0);
+}
+void Shape::destroy(Shape *root, IAllocator *allocator)
+{
+    Shape *child = root->children;
+    while (child)
+    {
+        Shape *sibling = child->sibling;
+        Shape::destroy(child, allocator);
+        child = sibling;
+    }
+    allocator->deallocate_raw(root);
+}
+
+Shape *Shape::add(const void *key, IAllocator *allocator)
+{
+    for (Shape *child = this->children; child; child = child->sibling)
+        if (child->key(this->count) == key)
+            return child;
+    if (this->count == SHAPE_MAX_KEYS ||
+        this->transitions == SHAPE_MAX_TRANSITIONS ||
+        this->root->total == SHAPE_MAX_COUNT)
+        return nullptr;
+    Shape *child = Shape::create(allocator, this->root, this->count + 1);
+    memcpy(child->keys(), this->keys(), this->count * sizeof(const void *));
+    child->keys()[this->count] = key;
+    child->sibling = this->children;
+    this->children = child;
+    this->transitions++;
+    this->root->total++;
+    return child;
+}
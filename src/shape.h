@@ -0,0 +1,73 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "virtuals.h"
+
+// a table with more keys than this is a dictionary
+#define SHAPE_MAX_KEYS 32
+// a shape that had this many different keys added to it takes no more
+#define SHAPE_MAX_TRANSITIONS 16
+// shapes are never freed before the runtime, the tree stops growing here
+#define SHAPE_MAX_COUNT 4096
+#define SHAPE_NO_INDEX SIZE_MAX
+
+namespace luayed
+{
+
+    // The string keys of a record-like table in the order they were added.
+    // Tables that got the same keys in the same order share a shape, which
+    // maps each key to the index of its value in the table's field slots.
+    // Shapes form a tree rooted at the empty shape: adding a key moves a
+    // table to the child of its shape for that key. Keys are compared by
+    // the address of the interned string, they are never read.
+    class Shape
+    {
+    private:
+        Shape *root;
+        Shape *children;
+        Shape *sibling;
+        size_t count;
+        size_t transitions;
+        // shapes in the whole tree, kept by the root
+        size_t total;
+
+        const void **keys()
+        {
+            return (const void **)(this + 1);
+        }
+        const void *const *keys() const
+        {
+            return (const void *const *)(this + 1);
+        }
+        static Shape *create(IAllocator *allocator, Shape *root, size_t count);
+
+    public:
+        static Shape *create_root(IAllocator *allocator);
+        // frees root and all the shapes below it
+        static void destroy(Shape *root, IAllocator *allocator);
+
+        // the shape with key appended, nullptr when the tree refuses to
+        // grow and the table has to become a dictionary
+        Shape *add(const void *key, IAllocator *allocator);
+        size_t size() const
+        {
+            return this->count;
+        }
+        const void *key(size_t idx) const
+        {
+            return this->keys()[idx];
+        }
+        size_t index(const void *key) const
+        {
+            const void *const *keys = this->keys();
+            for (size_t i = 0; i < this->count; i++)
+                if (keys[i] == key)
+                    return i;
+            return SHAPE_NO_INDEX;
+        }
+    };
+};
+
+#endif
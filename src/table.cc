@@ -1,4 +1,9 @@
 #include "table.h"
+#include <algorithm>
+
+#define TABLE_ARRAY_MIN 4
+#define TABLE_ARRAY_GROWTH_RATE 2
+#define TABLE_FIELDS_MIN 4
 
 using namespace luayed;
 
@@ -6,84 +11,403 @@ TableElement::TableElement(LuaValue key, LuaValue value) : key(key), value(value
 {
 }
 
-int table_compare(const TableElement &a, const TableElement &b)
+void Table::init(LuaRuntime *rt, size_t narr, size_t nrec)
 {
-    if (a.key == b.key)
-        return 0;
+    this->allocator = rt;
+    this->shape = nullptr;
+    this->fields = nullptr;
+    this->fcap = 0;
+    if (nrec > SHAPE_MAX_KEYS)
+        this->vset.init(rt, nrec);
     else
-        return 1;
+    {
+        this->shape = rt->shape_root();
+        this->fcap = nrec;
+        if (nrec)
+            this->fields = (LuaValue *)this->allocator->allocate_raw(nrec * sizeof(LuaValue));
+    }
+    this->array = nullptr;
+    this->acap = narr;
+    this->cleared = 0;
+    if (narr)
+    {
+        this->array = (LuaValue *)this->allocator->allocate_raw(narr * sizeof(LuaValue));
+        LuaValue nil;
+        for (size_t i = 0; i < narr; i++)
+            this->array[i] = nil;
+    }
+    this->alive = 0;
+    this->border = 0;
 }
-
-hash_t luavalue_hash(const LuaValue &v)
-{
-    LuaType k = v.kind;
-    char buf[9] = {k, 0, 0, 0, 0, 0, 0, 0, 0};
-    size_t *d = (size_t *)(buf + 1);
-    if (k == LuaType::LVBool)
-        *d = v.data.b;
-    else if (k == LuaType::LVNumber)
-        *d = v.data.n;
-    else if (k == LuaType::LVNil)
-        *d = 0;
+// copies both parts as they are, nothing is hashed again
+void Table::init(LuaRuntime *rt, const Table *tmpl)
+{
+    this->allocator = rt;
+    this->shape = tmpl->shape;
+    this->fields = nullptr;
+    this->fcap = 0;
+    if (!this->shape)
+        this->vset.init(rt, tmpl->vset);
+    else if (this->shape->size())
+    {
+        this->fcap = this->shape->size();
+        this->fields = (LuaValue *)this->allocator->allocate_raw(this->fcap * sizeof(LuaValue));
+        memcpy(this->fields, tmpl->fields, this->fcap * sizeof(LuaValue));
+    }
+    this->acap = tmpl->acap;
+    this->alive = tmpl->alive;
+    this->cleared = 0;
+    this->border = tmpl->border;
+    this->array = nullptr;
+    if (this->acap)
+    {
+        this->array = (LuaValue *)this->allocator->allocate_raw(this->acap * sizeof(LuaValue));
+        memcpy(this->array, tmpl->array, this->acap * sizeof(LuaValue));
+    }
+}
+void Table::destroy()
+{
+    if (this->shape)
+    {
+        if (this->fields)
+            this->allocator->deallocate_raw(this->fields);
+    }
     else
-        *d = (size_t)v.data.ptr;
-    return adler32(buf, 9);
+        this->vset.destroy();
+    if (this->array)
+        this->allocator->deallocate_raw(this->array);
 }
-
-hash_t table_hash(const TableElement &e)
+// moves the fields to the hash set, the table stays a dictionary. the set
+// gets room for as many keys as the field slots, presized or not
+void Table::make_dictionary()
 {
-    return luavalue_hash(e.key);
+    if (!this->shape)
+        return;
+    this->vset.init(this->allocator, this->fcap);
+    for (size_t i = 0; i < this->shape->size(); i++)
+    {
+        if (this->fields[i].kind == LuaType::LVNil)
+            continue;
+        LuaValue key;
+        key.kind = LuaType::LVString;
+        key.data.ptr = (void *)this->shape->key(i);
+        this->vset.insert(TableElement(key, this->fields[i]));
+    }
+    if (this->fields)
+        this->allocator->deallocate_raw(this->fields);
+    this->shape = nullptr;
+    this->fields = nullptr;
+    this->fcap = 0;
 }
-
-void Table::init(LuaRuntime *rt)
+void Table::field_add(const void *key, LuaValue value)
 {
-    this->vset.init(table_compare, table_hash, rt);
+    Shape *shape = this->shape->add(key, this->allocator);
+    if (!shape)
+    {
+        this->make_dictionary();
+        LuaValue k;
+        k.kind = LuaType::LVString;
+        k.data.ptr = (void *)key;
+        this->vset.insert(TableElement(k, value));
+        return;
+    }
+    this->shape_grow(shape, value);
 }
-void Table::destroy()
+// moves the table to shape, which has the table's keys and one more whose
+// value is value
+void Table::shape_grow(Shape *shape, LuaValue value)
 {
-    this->vset.destroy();
+    if (shape->size() > this->fcap)
+    {
+        size_t cap = std::max<size_t>(this->fcap * 2, TABLE_FIELDS_MIN);
+        cap = std::min<size_t>(cap, SHAPE_MAX_KEYS);
+        LuaValue *fields = (LuaValue *)this->allocator->allocate_raw(cap * sizeof(LuaValue));
+        if (this->fields)
+        {
+            memcpy(fields, this->fields, this->shape->size() * sizeof(LuaValue));
+            this->allocator->deallocate_raw(this->fields);
+        }
+        this->fields = fields;
+        this->fcap = cap;
+    }
+    this->fields[this->shape->size()] = value;
+    this->shape = shape;
 }
 TableIterator Table::iter() const
 {
     return TableIterator(this);
 }
 
+bool Table::array_index(LuaValue key, size_t &idx) const
+{
+    if (key.kind != LuaType::LVNumber)
+        return false;
+    linteger i;
+    if (key.is_int())
+        i = key.data.i;
+    else if (!number_to_int(key.data.n, &i))
+        return false;
+    // keys below 1 wrap around past any capacity
+    idx = (size_t)i - 1;
+    return true;
+}
+void Table::array_set(size_t idx, LuaValue value)
+{
+    bool was_nil = this->array[idx].kind == LuaType::LVNil;
+    this->array[idx] = value;
+    if (value.kind == LuaType::LVNil)
+    {
+        if (!was_nil)
+        {
+            this->alive--;
+            this->cleared++;
+        }
+        if (idx < this->border)
+            this->border = idx;
+        return;
+    }
+    this->alive += was_nil;
+    if (idx == this->border)
+    {
+        while (this->border < this->acap && this->array[this->border].kind != LuaType::LVNil)
+            this->border++;
+        // keep the sequence in the array when it goes on in the hash set
+        LuaValue key;
+        key.set_int(this->acap + 1);
+        while (this->border == this->acap && this->find(key))
+        {
+            this->array_grow();
+            key.set_int(this->acap + 1);
+        }
+    }
+}
+void Table::array_grow()
+{
+    size_t cap = this->acap ? this->acap * TABLE_ARRAY_GROWTH_RATE : TABLE_ARRAY_MIN;
+    LuaValue *array = (LuaValue *)this->allocator->allocate_raw(cap * sizeof(LuaValue));
+    if (this->array)
+    {
+        memcpy(array, this->array, this->acap * sizeof(LuaValue));
+        this->allocator->deallocate_raw(this->array);
+    }
+    LuaValue nil;
+    for (size_t i = this->acap; i < cap; i++)
+    {
+        LuaValue key;
+        key.set_int(i + 1);
+        TableElement *e = this->find(key);
+        if (e)
+        {
+            array[i] = e->value;
+            this->vset.remove(TableElement(key, nil));
+            this->alive++;
+        }
+        else
+            array[i] = nil;
+    }
+    this->array = array;
+    this->acap = cap;
+    this->cleared = 0;
+    while (this->border < this->acap && this->array[this->border].kind != LuaType::LVNil)
+        this->border++;
+}
+// keeps the array just big enough for the sequence, the other keys it held
+// move to the hash set
+void Table::array_shrink()
+{
+    size_t cap = TABLE_ARRAY_MIN;
+    while (cap <= this->border)
+        cap *= TABLE_ARRAY_GROWTH_RATE;
+    if (cap >= this->acap)
+        return;
+    this->make_dictionary();
+    for (size_t i = cap; i < this->acap; i++)
+    {
+        if (this->array[i].kind != LuaType::LVNil)
+        {
+            LuaValue key;
+            key.set_int(i + 1);
+            this->vset.insert(TableElement(key, this->array[i]));
+            this->alive--;
+        }
+    }
+    LuaValue *array = (LuaValue *)this->allocator->allocate_raw(cap * sizeof(LuaValue));
+    memcpy(array, this->array, cap * sizeof(LuaValue));
+    this->allocator->deallocate_raw(this->array);
+    this->array = array;
+    this->acap = cap;
+    this->cleared = 0;
+}
+
 void Table::set(LuaValue key, LuaValue value)
 {
+    size_t idx;
+    if (this->array_index(key, idx))
+    {
+        if (idx == this->acap && value.kind != LuaType::LVNil && this->alive >= this->acap / 2)
+            this->array_grow();
+        if (idx < this->acap)
+            return this->array_set(idx, value);
+    }
+    if (key.kind == LuaType::LVNumber && !key.is_int())
+    {
+        // integral float keys are stored as integers, so t[1.0] is t[1].
+        // the ones too wide for an unboxed integer stay floats, they hash
+        // and compare equal to the boxed integer all the same
+        linteger i;
+        if (number_to_int(key.data.n, &i) && LuaValue::fits_int(i))
+            key.set_int(i);
+    }
+    if (this->shape)
+    {
+        if (key.kind == LuaType::LVString)
+        {
+            size_t idx = this->shape->index(key.data.ptr);
+            if (idx != SHAPE_NO_INDEX)
+                this->fields[idx] = value;
+            else if (value.kind != LuaType::LVNil)
+                this->field_add(key.data.ptr, value);
+            return;
+        }
+        // the key cannot be there, no need to give up the shape for it
+        if (value.kind == LuaType::LVNil)
+            return;
+        this->make_dictionary();
+    }
     TableElement e(key, value);
     if (value.kind == LuaType::LVNil)
         this->vset.remove(e);
     else
+    {
+        // only when a key is added, assigning existing fields during a
+        // traversal must not move the others. presized arrays have not
+        // been cleared yet and are left alone
+        if (this->cleared > this->acap / 2 && this->alive < this->acap / 8 && !this->vset.get(e))
+            this->array_shrink();
         this->vset.insert(e);
+    }
 }
 LuaValue Table::get(LuaValue key) const
 {
+    size_t idx;
+    if (this->array_index(key, idx) && idx < this->acap)
+        return this->array[idx];
     LuaValue nil;
-    nil.kind = LuaType::LVNil;
-    TableElement e(key, nil);
-    TableElement *ep = this->vset.get(e);
+    if (this->shape)
+    {
+        size_t idx = key.kind == LuaType::LVString ? this->shape->index(key.data.ptr) : SHAPE_NO_INDEX;
+        return idx == SHAPE_NO_INDEX ? nil : this->fields[idx];
+    }
+    TableElement *ep = this->vset.get(TableElement(key, nil));
     if (ep)
         return ep->value;
     else
         return nil;
 }
-TableElement *Table::next(int &idx) const
+LuaValue Table::get_uncached(LuaValue key, FieldCache *c) const
+{
+    LuaValue v = this->get(key);
+    if (this->shape && key.kind == LuaType::LVString)
+    {
+        size_t idx = this->shape->index(key.data.ptr);
+        if (idx != SHAPE_NO_INDEX)
+            *c = {this->shape, idx, nullptr};
+    }
+    return v;
+}
+// a site that adds a key caches the transition, the next table of the
+// same shape moves to the new shape without looking anything up
+void Table::set_uncached(LuaValue key, LuaValue value, FieldCache *c)
+{
+    Shape *shape = this->shape;
+    if (shape && shape == c->shape && c->next && value.kind != LuaType::LVNil)
+        return this->shape_grow(c->next, value);
+    this->set(key, value);
+    if (!this->shape || key.kind != LuaType::LVString)
+        return;
+    size_t idx = this->shape->index(key.data.ptr);
+    if (shape && shape != this->shape)
+        *c = {shape, idx, this->shape};
+    else if (idx != SHAPE_NO_INDEX)
+        *c = {this->shape, idx, nullptr};
+}
+const Shape *Table::get_shape() const
+{
+    return this->shape;
+}
+TableElement *Table::find(LuaValue key) const
+{
+    if (this->shape)
+        return nullptr;
+    LuaValue nil;
+    return this->vset.get(TableElement(key, nil));
+}
+size_t Table::version() const
+{
+    return this->shape ? 0 : this->vset.version();
+}
+size_t Table::length() const
+{
+    // a sequence filling the array is never continued by the hash set, the
+    // array grows over it instead
+    return this->border;
+}
+// slots allocated by the array and the hash set together
+size_t Table::capacity() const
+{
+    return this->acap + (this->shape ? this->fcap : this->vset.capacity());
+}
+bool Table::next(int &idx, LuaValue &key, LuaValue &value) const
 {
-    return this->vset.iter(idx);
+    // array slots come first, then the fields or the buckets of the hash set
+    int acap = this->acap;
+    for (int i = idx + 1; i < acap; i++)
+    {
+        if (this->array[i].kind != LuaType::LVNil)
+        {
+            idx = i;
+            key.set_int(i + 1);
+            value = this->array[i];
+            return true;
+        }
+    }
+    int hidx = std::max(idx, acap - 1) - acap;
+    if (this->shape)
+    {
+        int count = this->shape->size();
+        for (int i = hidx + 1; i < count; i++)
+        {
+            if (this->fields[i].kind != LuaType::LVNil)
+            {
+                idx = i + acap;
+                key.kind = LuaType::LVString;
+                key.data.ptr = (void *)this->shape->key(i);
+                value = this->fields[i];
+                return true;
+            }
+        }
+        return false;
+    }
+    TableElement *e = this->vset.iter(hidx);
+    if (!e)
+        return false;
+    idx = hidx + acap;
+    key = e->key;
+    value = e->value;
+    return true;
 }
 TableIterator::TableIterator(const Table *table) : table(table)
 {
 }
 bool TableIterator::next()
 {
-    this->el = this->table->next(this->idx);
-    return this->el != nullptr;
+    return this->table->next(this->idx, this->k, this->v);
 }
 LuaValue TableIterator::key() const
 {
-    return this->el->key;
+    return this->k;
 }
 LuaValue TableIterator::value() const
 {
-    return this->el->value;
+    return this->v;
 }
\ No newline at end of file
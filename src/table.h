@@ -4,6 +4,7 @@
 #include "set.h"
 #include "runtime.h"
 #include "hash.h"
+#include "shape.h"
 
 namespace luayed
 {
@@ -19,20 +20,115 @@ namespace luayed
         TableElement(LuaValue key, LuaValue value);
     };
 
+    // interned strings reuse the hash computed when they were interned,
+    // everything else, short strings included, is a word that only needs
+    // mixing
+    inline hash_t luavalue_hash(const LuaValue &v)
+    {
+        if (v.kind == LuaType::LVString && !v.is_sstr())
+            return (v.as<lstr_p>() - 1)->hash;
+        if (v.kind == LuaType::LVNumber)
+        {
+            if (v.is_int())
+                return hash_mix(v.data.i);
+            // floats equal to an integer must land on the integer's slot
+            lnumber n = v.data.n;
+            linteger i;
+            if (number_to_int(n, &i))
+                return hash_mix(i);
+            uint64_t bits;
+            memcpy(&bits, &n, sizeof(n));
+            return hash_mix(bits);
+        }
+        if (v.kind == LuaType::LVBool)
+            return hash_mix(v.data.b);
+        return hash_mix((uintptr_t)v.data.ptr);
+    }
+
+    struct TableHash
+    {
+        hash_t operator()(const TableElement &e) const
+        {
+            return luavalue_hash(e.key);
+        }
+    };
+    struct TableEq
+    {
+        bool operator()(const TableElement &a, const TableElement &b) const
+        {
+            return a.key == b.key;
+        }
+    };
+
+    // Positive integer keys up to the array capacity live in a dense
+    // array, everything else in the hash part. The array grows when a key
+    // right past its end is set while at least half of it is in use,
+    // taking over the following keys from the hash part. It shrinks when
+    // a new key goes to the hash part after half of the array was cleared
+    // and it is almost empty, so a table used as a queue does not keep the
+    // array of its longest day. border caches a length: t[1..border] are not nil and
+    // t[border + 1] is nil, it is in the array unless the array is full.
+    //
+    // The hash part of a table whose keys there are all strings is a shape
+    // and a vector of field slots, a field keeps its slot when it is set to
+    // nil. The first other key, or a key the shape tree refuses, turns the
+    // hash part into a dictionary: the hash set, for good.
     class Table
     {
     private:
-        Set<TableElement> vset;
+        Set<TableElement, TableHash, TableEq> vset;
+        IAllocator *allocator;
+        Shape *shape;
+        LuaValue *fields;
+        size_t fcap;
+        LuaValue *array;
+        size_t acap;
+        size_t alive;
+        size_t cleared;
+        size_t border;
+
+        bool array_index(LuaValue key, size_t &idx) const;
+        void array_set(size_t idx, LuaValue value);
+        void array_grow();
+        void array_shrink();
+        void field_add(const void *key, LuaValue value);
+        void shape_grow(Shape *shape, LuaValue value);
+        LuaValue get_uncached(LuaValue key, FieldCache *c) const;
+        void set_uncached(LuaValue key, LuaValue value, FieldCache *c);
 
     public:
         Table(LuaRuntime *rt);
         void clean();
-        void init(LuaRuntime *rt);
+        void init(LuaRuntime *rt, size_t narr = 0, size_t nrec = 0);
+        void init(LuaRuntime *rt, const Table *tmpl);
         void destroy();
+        void make_dictionary();
 
         void set(LuaValue key, LuaValue value);
         LuaValue get(LuaValue key) const;
-        TableElement *next(int &idx) const;
+        // accesses through the inline cache of a site with a constant key,
+        // a hit goes straight to the field slot
+        LuaValue get(LuaValue key, FieldCache *c) const
+        {
+            if (this->shape == c->shape && this->shape)
+                return this->fields[c->index];
+            return this->get_uncached(key, c);
+        }
+        void set(LuaValue key, LuaValue value, FieldCache *c)
+        {
+            if (this->shape == c->shape && this->shape && !c->next)
+                this->fields[c->index] = value;
+            else
+                this->set_uncached(key, value, c);
+        }
+        // null once the table is a dictionary
+        const Shape *get_shape() const;
+        // only dictionaries have elements to find
+        TableElement *find(LuaValue key) const;
+        size_t version() const;
+        size_t length() const;
+        size_t capacity() const;
+        bool next(int &idx, LuaValue &key, LuaValue &value) const;
         TableIterator iter() const;
     };
 
@@ -41,7 +137,8 @@ namespace luayed
     private:
         const Table *table = nullptr;
         int idx = -1;
-        TableElement *el = nullptr;
+        LuaValue k;
+        LuaValue v;
 
     public:
         TableIterator(const Table *table);
@@ -116,7 +116,7 @@ public:
     }
 };
 
-GenTest compiler_test_case(const char *message, const char *text)
+GenTest compiler_test_case(const char *message, const char *text, bool register_ops = false, bool superinstructions = false)
 {
     GenTest gentest(message);
     StringSourceReader reader(text);
@@ -132,6 +132,8 @@ GenTest compiler_test_case(const char *message, const char *text)
     Resolver analyzer(ast, text);
     analyzer.analyze();
     Compiler compiler(&gentest);
+    compiler.config_register_ops(register_ops);
+    compiler.config_superinstructions(superinstructions);
     compiler.compile(ast, text, nullptr);
     return gentest;
 }
@@ -821,11 +823,10 @@ void compiler_tests()
             inil,
             inil,
             ilocal(0),
-            inot,
-            icjmp(16),
+            ifjmp(15),
             ilocal(1),
             icall(0, 1),
-            ijmp(16),
+            ijmp(15),
             // end
             ipop(2),
             iret(0),
@@ -853,12 +854,11 @@ void compiler_tests()
             inil,
             // if
             ilocal(0),
-            inot,
-            icjmp(17),
+            ifjmp(16),
             // then
             ilocal(1),
             icall(0, 1),
-            ijmp(22),
+            ijmp(21),
             // else
             ilocal(2),
             icall(0, 1),
@@ -889,26 +889,21 @@ void compiler_tests()
             inil,
             inil,
             inil,
-            // if 3
-            itrue,
-            inot,
-            icjmp(16),
-            // then 8
+            // then 3
             ilocal(0),
             icall(0, 1),
-            ijmp(34),
-            // elseif 16
+            ijmp(28),
+            // elseif 11
             ifalse,
-            inot,
-            icjmp(29),
-            // then 21
+            ifjmp(23),
+            // then 15
             ilocal(1),
             icall(0, 1),
-            ijmp(34),
-            // else 29
+            ijmp(28),
+            // else 23
             ilocal(2),
             icall(0, 1),
-            // end 34
+            // end 28
             ipop(3),
             iret(0),
         });
@@ -925,11 +920,9 @@ void compiler_tests()
         .test_upvalues({})
         .test_opcodes({
             ifalse,
-            iblocal(1),
-            icjmp(10),
-            ipop(1),
+            iorjmp(6),
             iconst(0),
-            // cjmp 10
+            // orjmp 6
             ipop(1),
             iret(0),
         });
@@ -946,12 +939,9 @@ void compiler_tests()
         .test_upvalues({})
         .test_opcodes({
             itrue,
-            iblocal(1),
-            inot,
-            icjmp(11),
-            ipop(1),
+            iandjmp(6),
             iconst(0),
-            // cjmp 11
+            // andjmp 6
             ipop(1),
             iret(0),
         });
@@ -968,15 +958,11 @@ void compiler_tests()
         .test_upvalues({})
         .test_opcodes({
             inil,
-            // while 1
-            itrue,
-            inot,
-            icjmp(14),
-            // do
+            // while 1, the true condition needs no test
             ilocal(0),
             icall(0, 1),
             ijmp(1),
-            // end 14
+            // end 9
             ipop(1),
             iret(0),
         });
@@ -994,15 +980,11 @@ void compiler_tests()
         .test_opcodes({
             ifalse,
             iconst(0),
-            // while 1
-            itrue,
-            inot,
-            icjmp(16),
-            // do
+            // while 3
             ilocal(0),
             icall(0, 1),
             ijmp(3),
-            // end 14
+            // end 11
             ipop(2),
             iret(0),
         });
@@ -1024,8 +1006,7 @@ void compiler_tests()
             icall(0, 1),
             // until
             ifalse,
-            inot,
-            icjmp(1),
+            ifjmp(1),
             // end
             ipop(1),
             iret(0),
@@ -1043,13 +1024,12 @@ void compiler_tests()
         .test_upvalues({})
         .test_opcodes({
             iconst(0),
-            // repeat 1
+            // repeat 2
             ilocal(0),
             icall(0, 1),
             // until
             ifalse,
-            inot,
-            icjmp(2),
+            ifjmp(2),
             // end
             ipop(1),
             iret(0),
@@ -1062,15 +1042,11 @@ void compiler_tests()
 
         .test_fn(1)
         .test_opcodes({
-            // condition 0
-            itrue,
-            inot,
-            icjmp(11),
-            // block 5
-            ijmp(11),
-            // end of block 8
+            // block 0
+            ijmp(6),
+            // end of block 3
             ijmp(0),
-            // end of loop 11
+            // end of loop 6
             iret(0),
         });
 
@@ -1081,18 +1057,14 @@ void compiler_tests()
 
         .test_fn(1)
         .test_opcodes({
-            // condition 0
-            itrue,
-            inot,
-            icjmp(16),
-            // block 5
+            // block 0
             inil,
             ipop(1),
-            ijmp(16),
+            ijmp(11),
             ipop(1),
-            // end of block 13
+            // end of block 8
             ijmp(0),
-            // end of loop 16
+            // end of loop 11
             iret(0),
         });
 
@@ -1119,29 +1091,22 @@ void compiler_tests()
             iconst(0),
             iconst(1),
             iconst(2),
-            // condition 7
-            iblocal(3),
-            iblocal(3),
-            igt,
-            icjmp(42),
-            // block 15
+            // prepare 7
+            iforprep(30),
+            // block 10
             inil,
             ipop(4),
-            ijmp(44),
+            ijmp(32),
             ilocal(0),
             ilocal(4),
             ilocal(1),
             icall(2, 1),
             ipop(1),
-            // increment 32
-            iblocal(3),
-            iblocal(2),
-            iadd,
-            iblstore(3),
-            ijmp(7),
-            // loop end 42
+            // step 27
+            iforloop(10),
+            // loop end 30
             ipop(3),
-            // end 44
+            // end 32
             inil,
             ilocal(1),
             ilstore(0),
@@ -1359,27 +1324,20 @@ void compiler_tests()
             iupush,
             iconst(1),
             iconst(2),
-            // condition 7
-            iblocal(3),
-            iblocal(3),
-            igt,
-            icjmp(35),
-            // block 15
+            // prepare 7
+            iforprep(23),
+            // block 10
             ifconst(2),
             ipop(4),
             iupop,
-            ijmp(38),
+            ijmp(26),
             ipop(1),
-            // increment 25
-            iblocal(3), // counter
-            iblocal(2), // step
-            iadd,
-            iblstore(3), // store new counter
-            ijmp(7),
-            // loop end 35
+            // step 20
+            iforloop(10),
+            // loop end 23
             iupop,
             ipop(3),
-            // end 38
+            // end 26
             iret(0),
         })
 
@@ -1549,7 +1507,7 @@ void compiler_tests()
         .test_ccount(0)
         .test_upvalues({})
         .test_opcodes({
-            itnew,
+            itnew(0, 0),
             ipop(1),
             iret(0),
         });
@@ -1565,7 +1523,7 @@ void compiler_tests()
         .test_ccount(3)
         .test_upvalues({})
         .test_opcodes({
-            itnew,
+            itnew(0, 2),
             // foo
             iconst(0),
             iconst(1),
@@ -1591,7 +1549,7 @@ void compiler_tests()
         .test_upvalues({})
         .test_opcodes({
             inil,
-            itnew,
+            itnew(2, 2),
             // [1]
             iconst(0),
             iconst(1),
@@ -1625,7 +1583,7 @@ void compiler_tests()
         .test_upvalues({})
         .test_opcodes({
             inil,
-            itnew,
+            itnew(2, 1),
             // [1]
             iconst(0),
             iconst(1),
@@ -1823,7 +1781,7 @@ void compiler_tests()
         .test_ccount(1)
         .test_upvalues({})
         .test_opcodes({
-            itnew,
+            itnew(0, 0),
             ilocal(0),
             iconst(0),
             ifconst(2),
@@ -1864,7 +1822,7 @@ void compiler_tests()
         .test_ccount(1)
         .test_upvalues({})
         .test_opcodes({
-            itnew,
+            itnew(0, 0),
             ilocal(0),
             iconst(0),
             ifconst(2),
@@ -2016,16 +1974,16 @@ void compiler_tests()
 
         .test_fn(1)
         .test_opcodes({
-            itnew,     // 0
-            iconst(0), // 1
-            iconst(1), // 3
-            imult,     // 5
-            iconst(2), // 6
-            itset,     // 8
-            ipop(1),   // 9
-            iret(0),   // 11
+            itnew(0, 0), // 0
+            iconst(0),   // 3
+            iconst(1),   // 5
+            imult,       // 7
+            iconst(2),   // 8
+            itset,       // 10
+            ipop(1),     // 11
+            iret(0),     // 13
         })
-        .test_debug_info(8, 4);
+        .test_debug_info(10, 4);
 
     compiler_test_case(
         "debug info > table property",
@@ -2038,14 +1996,14 @@ void compiler_tests()
 
         .test_fn(1)
         .test_opcodes({
-            itnew,     // 0
-            iconst(0), // 1
-            iconst(1), // 3
-            itset,     // 5
-            ipop(1),   // 6
-            iret(0),   // 8
+            itnew(0, 0), // 0
+            iconst(0),   // 3
+            iconst(1),   // 5
+            itset,       // 7
+            ipop(1),     // 8
+            iret(0),     // 10
         })
-        .test_debug_info(5, 3);
+        .test_debug_info(7, 3);
 
     compiler_test_case(
         "debug info > table contructor",
@@ -2063,16 +2021,16 @@ void compiler_tests()
 
         .test_fn(1)
         .test_opcodes({
-            itnew,     // 0
-            iconst(0), // 1
-            iconst(1), // 3
-            iconcat,   // 5
-            iconst(2), // 6
-            itset,     // 8
-            iret(1),   // 9
-            iret(0),   // 11
+            itnew(0, 1), // 0
+            iconst(0),   // 3
+            iconst(1),   // 5
+            iconcat,     // 7
+            iconst(2),   // 8
+            itset,       // 10
+            iret(1),     // 11
+            iret(0),     // 13
         })
-        .test_debug_info(8, 4);
+        .test_debug_info(10, 4);
 
     compiler_test_case(
         "debug info > call",
@@ -2199,4 +2157,190 @@ void compiler_tests()
             ipop(1),
             iret(0),
         });
-}
\ No newline at end of file
+
+    compiler_test_case(
+        "register arithmetic",
+
+        "local a, b = 1, 2\n"
+        "a = b + 3\n"
+        "local c = a * b\n"
+        "b = a\n"
+        "c = (a + b) - c",
+        true)
+
+        .test_fn(1)
+        .test_ccount(3)
+        .test_opcodes({
+            iconst(0),
+            iconst(1),
+            iradd(0, 1, REG_CONST | 2),
+            irmult(REG_STACK, 0, 1),
+            irmove(1, 0),
+            iradd(REG_STACK, 0, 1),
+            irsub(2, REG_STACK, 2),
+            ipop(3),
+            iret(0),
+        });
+
+    compiler_test_case(
+        "register arithmetic fallback",
+
+        "local t = {}\n"
+        "t.x = t.x + 1\n"
+        "return t[1] + t[2]",
+        true)
+
+        .test_fn(1)
+        .test_opcodes({
+            itnew(0, 0),
+            ilocal(0),
+            iconst(0),
+            ilocal(0),
+            iconst(2),
+            itget,
+            iradd(REG_STACK, REG_STACK, REG_CONST | 1),
+            itset,
+            ipop(1),
+            ilocal(0),
+            iconst(3),
+            itget,
+            ilocal(0),
+            iconst(4),
+            itget,
+            iadd,
+            iret(1),
+            ipop(1),
+            iret(0),
+        });
+
+    compiler_test_case(
+        "superinstructions",
+
+        "local a, b = 1, 2\n"
+        "while a < 10 do a = a + b end\n"
+        "if a ~= b then a = 0 end\n"
+        "local t = { x = a, 5 }\n"
+        "t.y = t.x * 2\n"
+        "t:m(a)",
+        false,
+        true)
+
+        .test_fn(1)
+        .test_opcodes({
+            iconst(0),                                   // 0
+            iconst(1),                                   // 2
+            irjnlt(21, 0, REG_CONST | 2),                // 4
+            iradd(0, 0, 1),                              // 11
+            ijmp(4),                                     // 18
+            irjeq(36, 0, 1),                             // 21
+            irmove(0, REG_CONST | 3),                    // 28
+            ijmp(36),                                    // 33
+            itnew(1, 1),                                 // 36
+            ilocal(0),                                   // 39
+            itsetk(4),                                   // 41
+            iconst(6),                                   // 43
+            itsetk(5),                                   // 45
+            ilocal(2),                                   // 47
+            ilocal(2),                                   // 49
+            itgetk(8),                                   // 51
+            irmult(REG_STACK, REG_STACK, REG_CONST | 9), // 53
+            itsetk(7),                                   // 60
+            ipop(1),                                     // 62
+            inil,                                        // 64
+            ilocal(2),                                   // 65
+            iself(10),                                   // 67
+            ilocal(0),                                   // 69
+            icall(2, 1),                                 // 71
+            ipop(3),                                     // 74
+            iret(0),                                     // 76
+        });
+
+    compiler_test_case(
+        "superinstructions around jump targets",
+
+        "local a = 1\n"
+        "local b = a or 2\n"
+        "return a + b",
+        false,
+        true)
+
+        .test_fn(1)
+        .test_opcodes({
+            iconst(0),              // 0
+            ilocal(0),              // 2
+            iorjmp(9),              // 4
+            iconst(1),              // 7
+            iradd(REG_STACK, 0, 1), // 9
+            iret(1),
+            ipop(2),
+            iret(0),
+        });
+
+    compiler_test_case(
+        "compare and branch conditions",
+
+        "local a, b = 1, 10\n"
+        "while a < b and not (a == 5) do a = a + 1 end\n"
+        "return a",
+        true,
+        false)
+
+        .test_fn(1)
+        .test_opcodes({
+            iconst(0),                    // 0
+            iconst(1),                    // 2
+            irjnlt(28, 0, 1),             // 4
+            irjeq(28, 0, REG_CONST | 2),  // 11
+            iradd(0, 0, REG_CONST | 3),   // 18
+            ijmp(4),                      // 25
+            ilocal(0),                    // 28
+            iret(1),
+            ipop(2),
+            iret(0),
+        });
+
+    compiler_test_case(
+        "constant table templates",
+
+        "local a = { 1, 'x', k = true, [2.5] = false }\n"
+        "local b = { 1, a }",
+        false,
+        true)
+
+        .test_fn(1)
+        .test_ccount(12)
+        .test_opcodes({
+            itclone(8),
+            itnew(2, 0),
+            iconst(10),
+            itsetk(9),
+            ilocal(0),
+            itsetk(11),
+            ipop(2),
+            iret(0),
+        });
+
+    compiler_test_case(
+        "superinstructions on globals",
+
+        "a, b = b, a\n"
+        "print(a)",
+        false,
+        true)
+
+        .test_fn(1)
+        .test_opcodes({
+            inil,
+            inil,
+            iggetk(2),
+            iggetk(3),
+            iblstore(2),
+            iblstore(2),
+            igsetk(1),
+            igsetk(0),
+            iggetk(4),
+            iggetk(5),
+            icall(1, 1),
+            iret(0),
+        });
+}
@@ -7,6 +7,11 @@
 #include "test.h"
 #include "mockruntime.h"
 #include "lstrep.h"
+#include <compiler.h>
+#include <lua.h>
+#include <parser.h>
+#include <resolve.h>
+#include "reader.h"
 
 using namespace luayed;
 
@@ -100,7 +105,7 @@ public:
     InterpreterTestCase &execute()
     {
         const char *suffix = "(execution)";
-        Interpreter intp;
+        Interpreter<MockRuntime> intp;
         try
         {
             Fnresult rs = intp.run(&this->rt);
@@ -123,7 +128,7 @@ public:
     InterpreterTestCase &execute(vector<Instruction> instructions)
     {
         const char *suffix = "(execution)";
-        Interpreter intp;
+        Interpreter<MockRuntime> intp;
         intp.config_error_metadata(false);
         try
         {
@@ -139,6 +144,16 @@ public:
         }
         return *this;
     }
+    InterpreterTestCase &test_opcode(size_t idx, Opcode op)
+    {
+        this->test(this->rt.code()[idx].op == op, "(decoded opcode)");
+        return *this;
+    }
+    InterpreterTestCase &test_gc_polls(size_t count)
+    {
+        this->test(this->rt.gc_polls == count, "(gc polls)");
+        return *this;
+    }
     InterpreterTestCase &test_ret(size_t retc)
     {
         this->test(this->retarg == retc, "(return count)");
@@ -212,6 +227,49 @@ public:
     }
 };
 
+class TextGenerator : public BaseGenerator
+{
+public:
+    vector<Instruction> text()
+    {
+        vector<Instruction> text;
+        vector<lbyte> &bin = this->funcs[1]->text;
+        for (size_t i = 0; i < bin.size();)
+        {
+            size_t count;
+            text.push_back(Instruction::decode(&bin[i], &count));
+            i += count;
+        }
+        return text;
+    }
+};
+
+// the main function of a chunk compiled as Lua compiles it by default,
+// without constants so that it can run on the mock runtime
+vector<Instruction> compiled_text(const char *code)
+{
+    TextGenerator gen;
+    StringSourceReader reader(code);
+    Lexer lexer(&reader);
+    Parser parser(&lexer);
+    Ast ast = parser.parse();
+    Resolver analyzer(ast, code);
+    analyzer.analyze();
+    Compiler compiler(&gen);
+    compiler.config_superinstructions(LuaConfig().superinstructions);
+    compiler.config_register_ops(LuaConfig().register_vm);
+    compiler.compile(ast, code, nullptr);
+    return gen.text();
+}
+
+size_t opcode_index(const vector<Instruction> &text, Opcode op)
+{
+    size_t idx = 0;
+    while (idx < text.size() && text[idx].op != op)
+        idx++;
+    return idx;
+}
+
 void interpreter_tests()
 {
     InterpreterTestCase("push true")
@@ -426,6 +484,277 @@ void interpreter_tests()
             lvnumber(1),
         });
 
+    InterpreterTestCase("loop")
+        .set_constants({
+            lvnumber(0),
+            lvnumber(1),
+            lvnumber(5),
+        })
+        .set_stack({
+            lvnumber(3),
+            lvnumber(0),
+        })
+        .set_text({
+            ilocal(0),
+            iconst(0),
+            ieq,
+            icjmp(25),
+            ilocal(1),
+            iconst(2),
+            iadd,
+            ilstore(1),
+            ilocal(0),
+            iconst(1),
+            isub,
+            ilstore(0),
+            ijmp(0),
+            iret(0),
+        })
+        .execute()
+        .test_stack({
+            lvnumber(0),
+            lvnumber(15),
+        });
+
+    InterpreterTestCase("fused loop")
+        .set_constants({
+            lvnumber(0),
+            lvnumber(1),
+            lvnumber(5),
+        })
+        .set_stack({
+            lvnumber(3),
+            lvnumber(0),
+        })
+        .set_text({
+            irjeq(24, 0, REG_CONST | 0),   // 0
+            iradd(1, 1, REG_CONST | 2),    // 7
+            irsub(0, 0, REG_CONST | 1),    // 14
+            ijmp(0),                       // 21
+            iret(0),                       // 24
+        })
+        .execute()
+        .test_stack({
+            lvnumber(0),
+            lvnumber(15),
+        });
+
+    InterpreterTestCase("fused negated branch")
+        .set_constants({
+            lvnumber(3),
+            lvnumber(1),
+            lvnumber(2),
+        })
+        .set_stack({
+            lvnumber(0),
+            lvnumber(0),
+        })
+        .set_text({
+            irjnlt(24, 0, REG_CONST | 0), // 0
+            iradd(0, 0, REG_CONST | 1),   // 7
+            iradd(1, 1, REG_CONST | 2),   // 14
+            ijmp(0),                      // 21
+            iret(0),                      // 24
+        })
+        .execute()
+        .test_stack({
+            lvnumber(3),
+            lvnumber(6),
+        });
+
+    InterpreterTestCase("quickened loop")
+        .set_constants({
+            lvnumber(1),
+            lvnumber(0),
+        })
+        .set_stack({
+            lvnumber(0),
+            lvnumber(3),
+        })
+        .set_text({
+            ilocal(0),  // 0
+            ilocal(1),  // 2
+            iadd,       // 4
+            ilstore(0), // 5
+            ilocal(1),  // 7
+            iconst(0),  // 9
+            isub,       // 11
+            ilstore(1), // 12
+            ilocal(1),  // 14
+            iconst(1),  // 16
+            igt,        // 18
+            icjmp(0),   // 19
+            iret(0),    // 22
+        })
+        .execute()
+        .test_stack({
+            lvnumber(6),
+            lvnumber(0),
+        })
+        .test_opcode(2, Opcode::IAddNN)
+        .test_opcode(6, Opcode::ISubNN)
+        .test_opcode(10, Opcode::IGtNN)
+        .test_gc_polls(2);
+
+    vector<Instruction> radd = compiled_text("local b, c = ... local a = b + c return a");
+    InterpreterTestCase("quickened compiled register arithmetic")
+        .set_args({
+            lvnumber(2),
+            lvnumber(3),
+        })
+        .set_text(radd)
+        .execute()
+        .test_ret(1)
+        .test_opcode(opcode_index(radd, Opcode::IRAdd), Opcode::IRAddNN);
+
+    InterpreterTestCase("gc safepoints")
+        .set_text({
+            itnew(0, 0),
+            ipop(1),
+            inil,
+            ipop(1),
+            ijmp(9),
+            iret(0),
+        })
+        .execute()
+        .test_gc_polls(1);
+
+    InterpreterTestCase("quickened deoptimization")
+        .set_constants({
+            lvstring("2"),
+        })
+        .set_stack({
+            lvnumber(0),
+            lvnumber(1),
+        })
+        .set_text({
+            ilocal(0),  // 0
+            ilocal(1),  // 2
+            iadd,       // 4
+            ilstore(0), // 5
+            ilocal(1),  // 7
+            iconst(0),  // 9
+            ieq,        // 11
+            icjmp(22),  // 12
+            iconst(0),  // 15
+            ilstore(1), // 17
+            ijmp(0),    // 19
+            iret(0),    // 22
+        })
+        .execute()
+        .test_stack({
+            lvnumber(3),
+            lvstring("2"),
+        })
+        .test_opcode(2, Opcode::IAdd);
+
+    InterpreterTestCase("quickened register deoptimization")
+        .set_constants({
+            lvstring("2"),
+        })
+        .set_stack({
+            lvnumber(0),
+            lvnumber(1),
+        })
+        .set_text({
+            iradd(0, 0, 1),              // 0
+            irjeq(21, 1, REG_CONST | 0), // 7
+            iconst(0),                   // 14
+            ilstore(1),                  // 16
+            ijmp(0),                     // 18
+            iret(0),                     // 21
+        })
+        .execute()
+        .test_stack({
+            lvnumber(3),
+            lvstring("2"),
+        })
+        .test_opcode(0, Opcode::IRAdd);
+
+    InterpreterTestCase("numeric for")
+        .set_stack({
+            lvnumber(0),
+            lvnumber(1),
+            lvnumber(4),
+            lvnumber(1),
+        })
+        .set_text({
+            iforprep(13),   // 0
+            iradd(0, 0, 1), // 3
+            iforloop(3),    // 10
+            iret(0),        // 13
+        })
+        .execute()
+        .test_stack({
+            lvnumber(10),
+            lvnumber(5),
+            lvnumber(4),
+            lvnumber(1),
+        });
+
+    InterpreterTestCase("numeric for negative step")
+        .set_stack({
+            lvnumber(0),
+            lvnumber(10),
+            lvnumber(1),
+            lvnumber(-3),
+        })
+        .set_text({
+            iforprep(13),   // 0
+            iradd(0, 0, 1), // 3
+            iforloop(3),    // 10
+            iret(0),        // 13
+        })
+        .execute()
+        .test_stack({
+            lvnumber(22),
+            lvnumber(-2),
+            lvnumber(1),
+            lvnumber(-3),
+        });
+
+    InterpreterTestCase("numeric for empty range")
+        .set_stack({
+            lvnumber(0),
+            lvnumber(5),
+            lvnumber(1),
+            lvnumber(1),
+        })
+        .set_text({
+            iforprep(13),   // 0
+            iradd(0, 0, 1), // 3
+            iforloop(3),    // 10
+            iret(0),        // 13
+        })
+        .execute()
+        .test_stack({
+            lvnumber(0),
+            lvnumber(5),
+            lvnumber(1),
+            lvnumber(1),
+        });
+
+    InterpreterTestCase("numeric for string bounds")
+        .set_stack({
+            lvnumber(0),
+            lvstring("2"),
+            lvstring("3"),
+            lvnumber(1),
+        })
+        .set_text({
+            iforprep(13),   // 0
+            iradd(0, 0, 1), // 3
+            iforloop(3),    // 10
+            iret(0),        // 13
+        })
+        .execute()
+        .test_stack({
+            lvnumber(5),
+            lvnumber(4),
+            lvnumber(3),
+            lvnumber(1),
+        });
+
     InterpreterTestCase("upvalue")
         .add_upvalue(lvnumber(7))
         .add_detached_upvalue(lvnumber(3))
@@ -979,6 +1308,77 @@ void interpreter_tests()
         })
         .test_error(error_invalid_operand(LuaType::LVString));
 
+    InterpreterTestCase("register add")
+        .set_constants({
+            lvnumber(2),
+        })
+        .set_stack({
+            lvnumber(3),
+            lvnumber(5),
+            lvnil(),
+        })
+        .execute({
+            iradd(2, 0, REG_CONST | 0),
+        })
+        .test_stack({
+            lvnumber(3),
+            lvnumber(5),
+            lvnumber(5),
+        });
+
+    InterpreterTestCase("register stack operands")
+        .set_stack({
+            lvnumber(4),
+            lvnumber(2),
+            lvnumber(3),
+        })
+        .execute({
+            irsub(REG_STACK, REG_STACK, 0),
+            irpow(REG_STACK, REG_STACK, REG_STACK),
+        })
+        .test_stack({
+            lvnumber(4),
+            lvnumber(0.5),
+        });
+
+    InterpreterTestCase("register move")
+        .set_constants({
+            lvnumber(7),
+        })
+        .set_stack({
+            lvnumber(1),
+            lvnumber(2),
+        })
+        .execute({
+            irmove(0, REG_CONST | 0),
+            irmove(1, 0),
+        })
+        .test_stack({
+            lvnumber(7),
+            lvnumber(7),
+        });
+
+    InterpreterTestCase("register invalid operand")
+        .set_stack({
+            lvnil(),
+            lvnumber(3),
+        })
+        .execute({
+            irmult(1, 1, 0),
+        })
+        .test_error(error_invalid_operand(LuaType::LVNil));
+
+    InterpreterTestCase("numeric for invalid limit")
+        .set_stack({
+            lvnumber(1),
+            lvbool(true),
+            lvnumber(1),
+        })
+        .execute({
+            iforprep(3),
+        })
+        .test_error(error_invalid_operand(LuaType::LVBool));
+
     InterpreterTestCase("invalid comparison")
         .set_stack({
             lvnumber(3),
@@ -1019,7 +1419,7 @@ void interpreter_tests()
             lvstring("3rd-value"), // value 3
         })
         .execute({
-            itnew,
+            itnew(0, 0),
             ilocal(0),
             ilocal(3),
             itset,
@@ -1056,12 +1456,50 @@ void interpreter_tests()
             lvstring("3rd-value"), // value 3
         });
 
+    InterpreterTestCase("table constant key")
+        .set_constants({
+            lvstring("k"),
+        })
+        .set_stack({
+            lvnumber(4),
+        })
+        .execute({
+            itnew(0, 0),
+            ilocal(0),
+            itsetk(0),
+            itgetk(0),
+        })
+        .test_stack({
+            lvnumber(4),
+            lvnumber(4),
+        });
+
+    InterpreterTestCase("method self lookup")
+        .set_constants({
+            lvstring("m"),
+        })
+        .set_stack({
+            lvnumber(9),
+        })
+        .execute({
+            inil,
+            itnew(0, 0),
+            ilocal(0),
+            itsetk(0),
+            iself(0),
+            ipop(1),
+        })
+        .test_stack({
+            lvnumber(9),
+            lvnumber(9),
+        });
+
     InterpreterTestCase("table non-existing property")
         .set_stack({
             lvstring("1st-key"), // key
         })
         .execute({
-            itnew,
+            itnew(0, 0),
             ilocal(0),
             itget,
         })
@@ -1081,7 +1519,7 @@ void interpreter_tests()
             lvstring("3rd-value"), // value 3
         })
         .execute({
-            itnew,
+            itnew(0, 0),
             ilocal(0),
             ilocal(3),
             itset,
@@ -1117,6 +1555,20 @@ void interpreter_tests()
             lvstring("mahdi"),
         });
 
+    InterpreterTestCase("globals with constant keys")
+        .set_constants({
+            lvstring("username"),
+            lvstring("mahdi"),
+        })
+        .execute({
+            iconst(1),
+            igsetk(0),
+            iggetk(0),
+        })
+        .test_stack({
+            lvstring("mahdi"),
+        });
+
     InterpreterTestCase("tailcall")
         .set_text({
             itcall(3),
@@ -218,10 +218,10 @@ void lexer_tests()
     lxtest("keyword (until)", "$until$", Until);
     lxtest("keyword (while)", "$while$", While);
 
-    lxtest("single digit", "$0$", Number);
-    lxtest("single digit", "$0$$+$", Number, Plus);
+    lxtest("single digit", "$0$", Integer);
+    lxtest("single digit", "$0$$+$", Integer, Plus);
     lxerrr("single digit .. letter", "0t");
-    lxtest("Integer", "$179$", Number);
+    lxtest("Integer", "$179$", Integer);
     lxerrr("Integer with letter in between", "179r76");
     lxtest("float", "$179.45$", Number);
     lxerrr("float multi-precision", "1.794.5");
@@ -231,7 +231,7 @@ void lexer_tests()
     lxtest("float with exponent", "$.3e7$ $0.4e-11$", Number, Number);
     lxtest("float without decimal with exponent", "$3.e-6$", Number);
     lxerrr("exponent without digits", ".2e");
-    lxtest("hex", "$0x3$", Number);
+    lxtest("hex", "$0x3$", Integer);
     lxerrr("hex without digits", "0x");
     lxerrr("hex followed by dot", "0x34.");
 
@@ -8,7 +8,7 @@ using namespace luayed;
 void lua_test_case_push(Lua &lua, LuaValue val)
 {
     if (val.kind == LuaType::LVString)
-        lua.push_string((const char *)val.data.ptr);
+        lua.push_string(val.str());
     else if (val.kind == LuaType::LVNumber)
         lua.push_number(val.data.n);
     else if (val.kind == LuaType::LVBool)
@@ -26,6 +26,8 @@ LuaValue lua_test_case_pop(Lua &lua)
         lua.pop();
         return lvnil();
     }
+    else if (kind == LUA_TYPE_NUMBER && lua.is_int())
+        return lvinteger(lua.pop_integer());
     else if (kind == LUA_TYPE_NUMBER)
         return lvnumber(lua.pop_number());
     else if (kind == LUA_TYPE_BOOLEAN)
@@ -43,6 +45,10 @@ LuaValue lua_test_case_pop(Lua &lua)
     }
 }
 
+static bool lua_test_register_vm = false;
+static bool lua_test_incremental_gc = false;
+static bool lua_test_generational_gc = false;
+
 void lua_test_case(
     const char *message,
     const char *code,
@@ -51,12 +57,18 @@ void lua_test_case(
     bool has_error = false,
     LuaValue error = lvnil())
 {
-    string mes = "lua : ";
+    string mes = lua_test_register_vm     ? "lua [register] : "
+                 : lua_test_incremental_gc  ? "lua [incremental gc] : "
+                 : lua_test_generational_gc ? "lua [generational gc] : "
+                                            : "lua : ";
     mes.append(message);
 
     LuaConfig conf;
     conf.error_metadata = false;
     conf.load_stdlib = false;
+    conf.register_vm = lua_test_register_vm;
+    conf.incremental_gc = lua_test_incremental_gc;
+    conf.generational_gc = lua_test_generational_gc;
     Lua lua(conf);
 
     string errors;
@@ -126,7 +138,7 @@ void lua_test_case_error(
     lua_test_case(message, code, {}, {}, true, lvstring(error.c_str()));
 }
 
-void lua_tests()
+void lua_test_suite()
 {
     lua_test_case("nothing", "", {});
 
@@ -357,6 +369,185 @@ void lua_tests()
             lvnumber(8),
         });
 
+    lua_test_case(
+        "operands changing type",
+
+        "local function cat(a, b) return a .. b end\n"
+        "local function less(a, b) return a < b end\n"
+        "local function add(a, b) return a + b end\n"
+        "local s = cat('a', 'b') .. cat(1, 2) .. cat('c', 'd')\n"
+        "local l = less(1, 2) and less('a', 'b') and not less(2, 1)\n"
+        "return s, l, add(1, 2) + add('3', 4) + add(5, 6)",
+
+        {
+            lvstring("ab12cd"),
+            lvbool(true),
+            lvnumber(21),
+        });
+
+    lua_test_case(
+        "branch conditions",
+
+        "local function f(a, b, c)\n"
+        "    local r = 0\n"
+        "    if a < b and not (b < c) then r = r + 1 end\n"
+        "    if a == 1 or b == 1 then r = r + 10 end\n"
+        "    if not (a ~= c) or (a and nil) then r = r + 100 end\n"
+        "    while a < b or c and c < b do a = a + 1 c = nil end\n"
+        "    return r, a, a > 2 and b or c, (a < 0 or nil) and 1\n"
+        "end\n"
+        "local r1, a1, v1, n1 = f(1, 3, 2)\n"
+        "local r2, a2, v2, n2 = f(2, 1, 2)\n"
+        "return r1 + r2, a1, v1, n1, a2, v2",
+
+        {
+            lvnumber(11 + 110),
+            lvnumber(3),
+            lvnumber(3),
+            lvnil(),
+            lvnumber(2),
+            lvnumber(2),
+        });
+
+    lua_test_case(
+        "integers and floats",
+
+        "local t = {}\n"
+        "t[1.0] = 'one' t[2] = 'two'\n"
+        "local n = 0\n"
+        "for i = 1, 10, 3 do n = n + i end\n"
+        "for i = 1.5, 3 do n = n + i end\n"
+        "return 7 // 2, -7 // 2, 7 % -3, 7.5 // 2, 7 / 2, 3 | 0x10, 2 ^ 2,\n"
+        "       t[1], t[2.0], #t, n, 1 == 1.0, 2 < 2.5, 0x7fffffff * 2",
+
+        {
+            lvinteger(3),
+            lvinteger(-4),
+            lvinteger(-2),
+            lvnumber(3),
+            lvnumber(3.5),
+            lvinteger(19),
+            lvnumber(4),
+            lvstring("one"),
+            lvstring("two"),
+            lvinteger(2),
+            lvnumber(22 + 1.5 + 2.5),
+            lvbool(true),
+            lvbool(true),
+            lvinteger(4294967294),
+        });
+
+    lua_test_case(
+        "64 bit integers",
+
+        "local max = 9223372036854775807\n"
+        "local t, k = {}, {}\n"
+        "for i = 1, 100, 1 do t[i] = (1 << 60) + i end\n"
+        "k[(1 << 60) + 1] = 'wide'\n"
+        "local s = 0\n"
+        "for i = 1, 100, 1 do s = s + (t[i] - (1 << 60)) end\n"
+        "return max + 1 < 0, max + 1 == -max - 1, ((1 << 62) | 1) - (1 << 62),\n"
+        "       (1 << 47) * 2 == 1 << 48, s, k[(1 << 60) + 1], -(-max - 1) == -max - 1",
+
+        {
+            lvbool(true),
+            lvbool(true),
+            lvinteger(1),
+            lvbool(true),
+            lvinteger(5050),
+            lvstring("wide"),
+            lvbool(true),
+        });
+
+    lua_test_case(
+        "wide float keys",
+
+        "local t = {}\n"
+        "t[2^48] = 'a' t[2^50] = 'b' t[2^60] = 'c' t[-2^52] = 'd'\n"
+        "return t[0], t[2^48], t[1 << 50], t[1 << 60], t[-(1 << 52)], t[2^50 + 1], t[2^50]",
+
+        {
+            lvnil(),
+            lvstring("a"),
+            lvstring("b"),
+            lvstring("c"),
+            lvstring("d"),
+            lvnil(),
+            lvstring("b"),
+        });
+
+    lua_test_case(
+        "integer concatenation",
+
+        "return 1000000 .. '', 9007199254740993 .. '', -(1 << 62) .. 'x', 1.5 .. ''",
+
+        {
+            lvstring("1000000"),
+            lvstring("9007199254740993"),
+            lvstring("-4611686018427387904x"),
+            lvstring("1.5"),
+        });
+
+    lua_test_case(
+        "numeric for with an implicit step",
+
+        "local h, w, i, k = 0, 0, 1\n"
+        "for j = 1, 40 do h = h * 31 + j end\n"
+        "while i <= 40 do w = w * 31 + i i = i + 1 end\n"
+        "for j = 1, 1 do k = (1 << 60) + j end\n"
+        "return h == w, k - (1 << 60)",
+
+        {
+            lvbool(true),
+            lvinteger(1),
+        });
+
+    lua_test_case(
+        "table length",
+
+        "local t, r, s = {}, {}, 0\n"
+        "for i = 1, 100 do t[#t + 1] = i end\n"
+        "t[#t] = nil\n"
+        "for i = 1, #t do s = s + t[i] end\n"
+        "for i = 20, 1, -1 do r[i] = i end\n"
+        "r[10] = nil\n"
+        "local n = 0\n"
+        "for i = 1, 20 do if r[i] then n = n + 1 end end\n"
+        "r[10] = 10\n"
+        "return #t, s, #r, n, #{1, 2, 3}, #'abc'",
+
+        {
+            lvinteger(99),
+            lvinteger(4950),
+            lvinteger(20),
+            lvinteger(19),
+            lvinteger(3),
+            lvinteger(3),
+        });
+
+    lua_test_case(
+        "cached globals",
+
+        "local function get() return g end\n"
+        "local function set(v) g = v end\n"
+        "set(1)\n"
+        "local a = get()\n"
+        "set(nil)\n"
+        "local b = get()\n"
+        "set(2)\n"
+        "g1, g2, g3, g4, g5, g6, g7, g8 = 1, 2, 3, 4, 5, 6, 7, 8\n"
+        "g9, g10, g11, g12, g13, g14, g15, g16 = 1, 2, 3, 4, 5, 6, 7, 8\n"
+        "local c = get()\n"
+        "set(3)\n"
+        "return a, b, c, get()",
+
+        {
+            lvnumber(1),
+            lvnil(),
+            lvnumber(2),
+            lvnumber(3),
+        });
+
     lua_test_case(
         "methods",
 
@@ -427,6 +618,45 @@ void lua_tests()
             lvbool(true),
         });
 
+    lua_test_case(
+        "numeric for negative step",
+
+        "local t = {}\n"
+        "for i = 10, 1, -3 do\n"
+        "    t[#t + 1] = i\n"
+        "end\n"
+        "for i = 1, 0 do\n"
+        "    t[#t + 1] = i\n"
+        "end\n"
+        "return #t, t[1], t[4]\n",
+
+        {
+            lvnumber(4),
+            lvnumber(10),
+            lvnumber(1),
+        });
+
+    lua_test_case(
+        "numeric for string bounds",
+
+        "local sum = 0\n"
+        "for i = '1', '4', '0.5' do\n"
+        "    sum = sum + i\n"
+        "end\n"
+        "return sum\n",
+
+        {
+            lvnumber(17.5),
+        });
+
+    lua_test_case_error(
+        "error: numeric for invalid step",
+
+        "for i = 1, 2, {} do\n"
+        "end\n",
+
+        to_string(error_invalid_operand(LuaType::LVTable), true));
+
     lua_test_case(
         "recursion",
 
@@ -643,4 +873,134 @@ void lua_tests()
         {
             lvbool(true),
         });
-}
\ No newline at end of file
+
+    lua_test_case(
+        "constant table constructors",
+        "local function f() return { 1, 2, x = 'a', [10] = true, [1.5] = false } end\n"
+        "local a, b = f(), f()\n"
+        "a[1] = 5 a.x = 'b' a[3] = 3\n"
+        "return b[1], b.x, #b, #a, a[10], b[1.5]",
+        {
+            lvnumber(1),
+            lvstring("a"),
+            lvnumber(2),
+            lvnumber(3),
+            lvbool(true),
+            lvbool(false),
+        });
+
+    lua_test_case(
+        "field caches over tables of many shapes",
+        "local function len(p) return p.x * p.x + p.y * p.y end\n"
+        "local function point(x, y) return { x = x, y = y } end\n"
+        "local ps = { point(3, 4), { y = 4, x = 3 }, { z = 0, x = 3, y = 4 }, point(3, 4) }\n"
+        "ps[4][1.5] = true\n"
+        "local s = 0\n"
+        "for i = 1, 3 do\n"
+        "    for j = 1, #ps do s = s + len(ps[j]) end\n"
+        "    ps[1].x = 0\n"
+        "end\n"
+        "local o = { n = 1 }\n"
+        "o.inc = function(self) self.n = self.n + 1 return self end\n"
+        "o:inc():inc()\n"
+        "return s, o.n, ps[2].z",
+        {
+            lvnumber(282),
+            lvnumber(3),
+            lvnil(),
+        });
+
+    lua_test_case(
+        "short and long strings",
+        "local t = {}\n"
+        "for i = 1, 20 do t[i .. ''] = i end\n"
+        "local s = ''\n"
+        "for i = 1, 9 do s = s .. i end\n"
+        "return t['7'], #s, s, 'ab' < 'abc', ('a' .. 'b') == 'ab'",
+        {
+            lvnumber(7),
+            lvnumber(9),
+            lvstring("123456789"),
+            lvbool(true),
+            lvbool(true),
+        });
+
+    lua_test_case(
+        "arithmetic on locals",
+        "local function f(a, ...)\n"
+        "    local b, c = a * 2, #{...}\n"
+        "    b = b + c\n"
+        "    c = 10 - b\n"
+        "    a = c\n"
+        "    return a, b, (a + b) / 2\n"
+        "end\n"
+        "return f(3, 'x', 'y')",
+        {
+            lvnumber(2),
+            lvnumber(8),
+            lvnumber(5),
+        });
+}
+
+void lua_test_create_table()
+{
+    const char *mes = "lua : presized table from the host";
+    LuaConfig conf;
+    conf.load_stdlib = false;
+    Lua lua(conf);
+    string errors;
+    if (lua.compile("local t = ... return #t, t.name", errors, mes) != LUA_COMPILE_RESULT_OK)
+        crash("compiling test case failed");
+    lua.create_table(3, 1);
+    for (linteger i = 1; i <= 3; i++)
+    {
+        lua.push_integer(i);
+        lua.push_integer(i * 10);
+        lua.set_table();
+    }
+    lua.push_string("name");
+    lua.push_string("row");
+    lua.set_table();
+    lua.call(1, 2);
+    bool rsl = !lua.has_error() && lua.top() == 2 && strcmp(lua.peek_string(), "row") == 0;
+    lua.pop();
+    rsl = rsl && lua.pop_number() == 3;
+    test_assert(rsl, mes);
+}
+
+void lua_test_integer_tostring()
+{
+    const char *mes = "lua : integers through the host api and tostring";
+    Lua lua;
+    string errors;
+    const char *code = "local n = 9007199254740993 return n, tostring(n), tostring(1000000), tostring(1.5)";
+    if (lua.compile(code, errors, mes) != LUA_COMPILE_RESULT_OK)
+        crash("compiling test case failed");
+    lua.call(0, 4);
+    bool rsl = !lua.has_error() && lua.top() == 4 && strcmp(lua.peek_string(), "1.5") == 0;
+    lua.pop();
+    rsl = rsl && strcmp(lua.peek_string(), "1000000") == 0;
+    lua.pop();
+    rsl = rsl && strcmp(lua.peek_string(), "9007199254740993") == 0;
+    lua.pop();
+    rsl = rsl && lua.is_int() && lua.pop_integer() == 9007199254740993;
+    test_assert(rsl, mes);
+}
+
+void lua_tests()
+{
+    lua_test_create_table();
+    lua_test_integer_tostring();
+    lua_test_suite();
+    // the whole suite is run again against the register instructions
+    lua_test_register_vm = true;
+    lua_test_suite();
+    lua_test_register_vm = false;
+    // and with the collector running in steps between instructions
+    lua_test_incremental_gc = true;
+    lua_test_suite();
+    lua_test_incremental_gc = false;
+    lua_test_generational_gc = true;
+    lua_test_suite();
+    lua_test_generational_gc = false;
+}
@@ -50,6 +50,10 @@ LuaValue MockRuntime::create_number(lnumber n)
 {
     return lvnumber(n);
 }
+LuaValue MockRuntime::create_integer(linteger n)
+{
+    return lvinteger(n);
+}
 LuaValue MockRuntime::create_string(const char *s)
 {
     return lvstring(s);
@@ -69,14 +73,24 @@ LuaValue MockRuntime::create_string(lnumber n)
 {
     return lvstring(to_string(n).c_str());
 }
-size_t MockRuntime::length(const char *str)
+LuaValue MockRuntime::create_string(linteger n)
+{
+    return lvstring(to_string(n).c_str());
+}
+size_t MockRuntime::length(LuaValue s)
 {
-    return strlen(str);
+    return strlen(s.str());
 }
-LuaValue MockRuntime::create_table()
+LuaValue MockRuntime::create_table(size_t narr, size_t nrec)
 {
     return lvtable();
 }
+LuaValue MockRuntime::clone_table(LuaValue t)
+{
+    LuaValue clone = lvtable();
+    *clone.as<vector<LuaValue> *>() = *t.as<vector<LuaValue> *>();
+    return clone;
+}
 LuaValue MockRuntime::create_luafn(fidx_t fidx)
 {
     this->icp_luafn.enable(fidx);
@@ -186,11 +200,23 @@ lbyte *MockRuntime::text()
 {
     return &this->instructions.front();
 }
+Dinstruction *MockRuntime::code()
+{
+    return &this->decoded.front();
+}
+uint32_t *MockRuntime::textpos()
+{
+    return &this->decoded_textpos.front();
+}
 LuaValue MockRuntime::chunkname()
 {
     return this->create_nil();
 }
 void MockRuntime::check_garbage_collection()
+{
+    this->gc_polls++;
+}
+void MockRuntime::write_barrier(void *obj, LuaValue v)
 {
 }
 dbginfo_t *MockRuntime::dbgmd()
@@ -220,6 +246,10 @@ void MockRuntime::set_text(vector<Bytecode> text)
             this->instructions.push_back(op.bytes[j]);
         }
     }
+    size_t count = predecode(&this->instructions.front(), this->instructions.size());
+    this->decoded.resize(count);
+    this->decoded_textpos.resize(count);
+    predecode(&this->instructions.front(), this->instructions.size(), &this->decoded.front(), &this->decoded_textpos.front());
 }
 void MockRuntime::store_ip(size_t ip)
 {
@@ -280,10 +310,33 @@ LuaValue MockRuntime::table_get(LuaValue t, LuaValue k)
     }
     return lvnil();
 }
+size_t MockRuntime::table_length(LuaValue t)
+{
+    linteger l = 1;
+    while (this->table_get(t, lvinteger(l)) != lvnil())
+        l++;
+    return l - 1;
+}
 LuaValue MockRuntime::table_global()
 {
     return this->global;
 }
+LuaValue MockRuntime::global_get(LuaValue k, size_t ic)
+{
+    return this->table_get(this->global, k);
+}
+void MockRuntime::global_set(LuaValue k, LuaValue v, size_t ic)
+{
+    this->table_set(this->global, k, v);
+}
+LuaValue MockRuntime::field_get(LuaValue t, LuaValue k, size_t ic)
+{
+    return this->table_get(t, k);
+}
+void MockRuntime::field_set(LuaValue t, LuaValue k, LuaValue v, size_t ic)
+{
+    this->table_set(t, k, v);
+}
 size_t MockRuntime::extras()
 {
     return 0;
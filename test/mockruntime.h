@@ -33,6 +33,8 @@ namespace luayed
         vector<LuaValue> constants;
         vector<LuaValue> args;
         vector<lbyte> instructions;
+        vector<Dinstruction> decoded;
+        vector<uint32_t> decoded_textpos;
         vector<Hook> upvalue_hooks;
         vector<LuaValue> upvalues;
         LuaValue error = lvnil();
@@ -48,6 +50,7 @@ namespace luayed
         Intercept icp_tailcall;
         Intercept icp_hookpush;
         Intercept icp_hookpop;
+        size_t gc_polls = 0;
 
         void set_stack(vector<LuaValue> stack);
         void set_constants(vector<LuaValue> constants);
@@ -57,7 +60,12 @@ namespace luayed
 
         void table_set(LuaValue t, LuaValue k, LuaValue v);
         LuaValue table_get(LuaValue t, LuaValue k);
+        size_t table_length(LuaValue t);
         LuaValue table_global();
+        LuaValue global_get(LuaValue k, size_t ic);
+        void global_set(LuaValue k, LuaValue v, size_t ic);
+        LuaValue field_get(LuaValue t, LuaValue k, size_t ic);
+        void field_set(LuaValue t, LuaValue k, LuaValue v, size_t ic);
 
         void add_upvalue(LuaValue value);
         void add_detached_upvalue(LuaValue value);
@@ -67,10 +75,13 @@ namespace luayed
         LuaValue create_nil();
         LuaValue create_boolean(bool b);
         LuaValue create_number(lnumber n);
+        LuaValue create_integer(linteger n);
         LuaValue create_string(const char *s);
         LuaValue create_string(lnumber n);
+        LuaValue create_string(linteger n);
         LuaValue create_string(const char *s1, const char *s2);
-        LuaValue create_table();
+        LuaValue create_table(size_t narr = 0, size_t nrec = 0);
+        LuaValue clone_table(LuaValue t);
         LuaValue create_luafn(fidx_t fidx);
         LuaValue stack_pop();
         void stack_push(LuaValue value);
@@ -84,6 +95,8 @@ namespace luayed
         Hook *upvalue(size_t idx);
         LuaValue rodata(size_t idx);
         lbyte *text();
+        Dinstruction *code();
+        uint32_t *textpos();
         void set_error(LuaValue value);
         LuaValue get_error();
         bool error_raised();
@@ -97,7 +110,8 @@ namespace luayed
         void check_garbage_collection();
         void store_ip(size_t ip);
         size_t load_ip();
-        size_t length(const char *str);
+        size_t length(LuaValue s);
+        void write_barrier(void *obj, LuaValue v);
     };
 };
 
@@ -1,4 +1,7 @@
 #include <runtime.h>
+#include "table.h"
+#include "gc.h"
+#include "arena.h"
 #include "test.h"
 #include "values.h"
 #include <lstrep.h>
@@ -56,6 +59,38 @@ void test_create_values()
     rt_assert(values[2].data.b == false, mes, 5);
 }
 
+void test_value_encoding()
+{
+    const char *mes = "value encoding";
+    LuaRuntime rt(nullptr);
+
+    LuaValue nan = rt.create_number(0.0 / 0.0);
+    LuaValue neg = rt.create_number(-1e300);
+    LuaValue inf = rt.create_number(-1.0 / 0.0);
+    LuaValue str = rt.create_string("encoded");
+    LuaValue t = rt.create_boolean(true);
+
+    rt_assert(nan.kind == LuaType::LVNumber && nan != nan, mes, 1);
+    rt_assert(neg.kind == LuaType::LVNumber && neg.data.n == -1e300, mes, 2);
+    rt_assert(inf.kind == LuaType::LVNumber && !is_obj(inf), mes, 3);
+    rt_assert(rt.create_number(0.0) == rt.create_number(-0.0), mes, 4);
+    rt_assert(str.kind == LuaType::LVString && is_obj(str), mes, 5);
+    rt_assert(strcmp(str.str(), "encoded") == 0, mes, 6);
+    rt_assert(t.kind == LuaType::LVBool && t.data.b && t.truth(), mes, 7);
+    rt_assert(!rt.create_boolean(false).truth() && !rt.create_nil().truth(), mes, 8);
+    rt_assert(rt.create_number(0).truth(), mes, 9);
+
+    LuaValue i = rt.create_integer(-42);
+    LuaValue big = rt.create_integer(1ll << 40);
+    rt_assert(i.kind == LuaType::LVNumber && i.is_int() && i.data.i == -42, mes, 11);
+    rt_assert(big.is_int() && big.number() == (lnumber)(1ll << 40), mes, 12);
+    rt_assert(i == rt.create_number(-42) && !rt.create_number(-42).is_int(), mes, 13);
+    rt_assert(i != rt.create_integer(42) && !is_obj(i) && i.truth(), mes, 14);
+#ifdef LUAYED_NAN_BOXING
+    rt_assert(sizeof(LuaValue) == 8, mes, 10);
+#endif
+}
+
 size_t lfcxx1(void *r)
 {
     LuaRuntime *rt = (LuaRuntime *)r;
@@ -217,25 +252,55 @@ void test_lua_calls_cxx()
     }
 }
 
+size_t lfcxx6(void *r)
+{
+    LuaRuntime *rt = (LuaRuntime *)r;
+    LuaValue first = rt->stack_read(0);
+    rt->stack_write(0, rt->stack_read(2));
+    rt->stack_write(2, first);
+    return 3;
+}
+
+void test_cxx_reads_args()
+{
+    LuaRuntime rt(nullptr);
+    rt.set_lua_interface(&rt);
+    rt.stack_push(rt.create_cppfn(lfcxx6));
+    pipe(&rt,
+         {
+             rt.create_number(1),
+             rt.create_number(2),
+             rt.create_number(3),
+         });
+    rt.call(3, 4);
+    vector<LuaValue> stack = drain(&rt);
+    vector<LuaValue> expected = {
+        rt.create_number(3),
+        rt.create_number(2),
+        rt.create_number(1),
+    };
+    rt_assert(stack == expected, "CXX reads its args by index", 1);
+}
+
 void test_string_creation()
 {
     LuaRuntime rt(nullptr);
     LuaValue v = rt.create_string("sample lua string");
-    bool rsl = strcmp(v.as<const char *>(), "sample lua string") == 0;
+    bool rsl = strcmp(v.str(), "sample lua string") == 0;
     rt_assert(rsl, "string creation", 1);
 }
 void test_string_concatenation()
 {
     LuaRuntime rt(nullptr);
     LuaValue v = rt.create_string("sample lua", " string");
-    bool rsl = strcmp(v.as<const char *>(), "sample lua string") == 0;
+    bool rsl = strcmp(v.str(), "sample lua string") == 0;
     rt_assert(rsl, "string concatenation", 1);
 }
 void test_string_from_number()
 {
     LuaRuntime rt(nullptr);
     LuaValue v = rt.create_string(8.11);
-    bool rsl = strcmp(v.as<const char *>(), "8.11") == 0;
+    bool rsl = strcmp(v.str(), "8.11") == 0;
     rt_assert(rsl, "string from number", 1);
 }
 void test_string_interning()
@@ -244,27 +309,462 @@ void test_string_interning()
     LuaRuntime rt(nullptr);
     LuaValue v1 = rt.create_string(str);
     LuaValue v2 = rt.create_string(str);
-    bool rsl = v1.as<const char *>() == v2.as<const char *>();
+    bool rsl = v1.str() == v2.str();
     rt_assert(rsl, "string interning", 1);
 }
+void test_short_strings()
+{
+    const char *mes = "short strings";
+    LuaRuntime rt(nullptr);
+    size_t used = rt.arena_stats().used;
+    LuaValue a = rt.create_string("ab");
+    LuaValue b = rt.create_string("a", "b");
+    LuaValue n = rt.create_string(7.0);
+    LuaValue e = rt.create_string("");
+    rt_assert(a.is_sstr() && n.is_sstr() && e.is_sstr(), mes, 1);
+    rt_assert(rt.arena_stats().used == used, mes, 2);
+    rt_assert(a == b && a != e && strcmp(b.str(), "ab") == 0 && strcmp(n.str(), "7") == 0, mes, 3);
+    rt_assert(rt.length(a) == 2 && rt.length(e) == 0, mes, 4);
+    rt_assert(luavalue_hash(a) == luavalue_hash(b) && luavalue_hash(a) != luavalue_hash(n), mes, 5);
+
+    // one byte past the limit is interned
+    string chars(SSTR_MAX_LEN + 1, 'x');
+    LuaValue l = rt.create_string(chars.c_str());
+    rt_assert(!l.is_sstr() && rt.length(l) == SSTR_MAX_LEN + 1, mes, 6);
+    rt_assert(rt.create_string(chars.c_str() + 1, "x") == l, mes, 7);
+
+    LuaValue t = rt.create_table();
+    rt.table_set(t, a, rt.create_integer(1));
+    rt.table_set(t, rt.create_number(1.5), rt.create_integer(2));
+    rt_assert(rt.table_get(t, b) == rt.create_integer(1), mes, 8);
+}
 void test_string()
 {
     test_string_creation();
     test_string_concatenation();
     test_string_interning();
     test_string_from_number();
+    test_short_strings();
+}
+
+void test_binary_predecode()
+{
+    const char *mes = "binary predecoding";
+    LuaRuntime rt(nullptr);
+    GenFunction gfn;
+    gfn.fidx = 0;
+    gfn.parcount = 0;
+    gfn.hookmax = 0;
+    vector<Instruction> text = {
+        inil,
+        ijmp(5),
+        inil,
+        ilocal(300),
+        iret(0),
+    };
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        Bytecode bc = text[i].encode();
+        for (lbyte j = 0; j < bc.count; j++)
+            gfn.text.push_back(bc.bytes[j]);
+    }
+    Lfunction *bin = rt.create_binary(&gfn);
+    rt_assert(bin->oplen == 5, mes, 1);
+    rt_assert(bin->codelen == 10, mes, 2);
+    rt_assert(bin->code()[1].op == Opcode::IJmp && bin->code()[1].a == 3, mes, 3);
+    rt_assert(bin->code()[3].op == Opcode::ILocal && bin->code()[3].a == 300, mes, 4);
+    rt_assert(bin->textpos()[3] == 5 && bin->textpos()[4] == 8, mes, 5);
+    rt_assert(bin->text()[5] == (Opcode::ILocal | 1), mes, 6);
+}
+
+void test_table_parts()
+{
+    const char *mes = "table array and hash parts";
+    LuaRuntime rt(nullptr);
+    LuaValue t = rt.create_table();
+    // set from the top down, the keys start in the hash part and move to
+    // the array part as it grows
+    for (linteger i = 64; i > 0; i--)
+        rt.table_set(t, rt.create_integer(i), rt.create_integer(i * 2));
+    rt_assert(rt.table_length(t) == 64, mes, 1);
+    rt_assert(rt.table_get(t, rt.create_integer(33)) == rt.create_integer(66), mes, 2);
+    rt_assert(rt.table_get(t, rt.create_number(7.0)) == rt.create_integer(14), mes, 3);
+    rt.table_set(t, rt.create_integer(40), rt.create_nil());
+    rt_assert(rt.table_length(t) == 39, mes, 4);
+    rt.table_set(t, rt.create_integer(40), rt.create_boolean(true));
+    rt_assert(rt.table_length(t) == 64, mes, 5);
+    rt.table_set(t, rt.create_number(65.0), rt.create_boolean(true));
+    rt.table_set(t, rt.create_integer(0), rt.create_boolean(true));
+    rt.table_set(t, rt.create_number(1.5), rt.create_boolean(true));
+    rt_assert(rt.table_length(t) == 65, mes, 6);
+
+    size_t count = 0;
+    TableIterator it = t.as<Table *>()->iter();
+    while (it.next())
+        count++;
+    rt_assert(count == 67, mes, 7);
+}
+
+void test_table_churn()
+{
+    const char *mes = "table hash part churn";
+    LuaRuntime rt(nullptr);
+    LuaValue t = rt.create_table();
+    // keep a sliding window of keys so removals leave dead slots that
+    // later inserts and rehashes have to reclaim
+    for (linteger i = 0; i < 4000; i++)
+    {
+        rt.table_set(t, rt.create_number(i + 0.5), rt.create_integer(i));
+        if (i >= 100)
+            rt.table_set(t, rt.create_number(i - 100 + 0.5), rt.create_nil());
+    }
+    bool found = true;
+    for (linteger i = 0; i < 4000; i++)
+    {
+        LuaValue v = rt.table_get(t, rt.create_number(i + 0.5));
+        if (i < 3900)
+            found = found && v.kind == LuaType::LVNil;
+        else
+            found = found && v == rt.create_integer(i);
+    }
+    rt_assert(found, mes, 1);
+
+    size_t count = 0;
+    TableIterator it = t.as<Table *>()->iter();
+    while (it.next())
+        count++;
+    rt_assert(count == 100, mes, 2);
+}
+
+void test_table_shrinking()
+{
+    const char *mes = "table hash part shrinking";
+    LuaRuntime rt(nullptr);
+    Set<TableElement, TableHash, TableEq> set;
+    set.init(&rt);
+    LuaValue nil = rt.create_nil();
+    for (linteger i = 0; i < 10000; i++)
+        set.insert(TableElement(rt.create_integer(i), nil));
+    size_t peak = set.capacity();
+    for (linteger i = 10; i < 10000; i++)
+        set.remove(TableElement(rt.create_integer(i), nil));
+    // a queue with a handful of entries: each new key is removed again
+    // right away, the dead slots pile up until a rehash shrinks the set
+    for (linteger i = 10000; i < 100000; i++)
+    {
+        set.insert(TableElement(rt.create_integer(i), nil));
+        set.remove(TableElement(rt.create_integer(i), nil));
+    }
+    rt_assert(set.size() == 10, mes, 1);
+    rt_assert(set.capacity() < peak && set.capacity() <= 64, mes, 2);
+    bool found = true;
+    for (linteger i = 0; i < 10; i++)
+        found = found && set.get(TableElement(rt.create_integer(i), nil));
+    rt_assert(found, mes, 3);
+    set.destroy();
+}
+
+void test_table_queue()
+{
+    const char *mes = "table used as a queue";
+    LuaRuntime rt(nullptr);
+    LuaValue t = rt.create_table();
+    Table *table = t.as<Table *>();
+    linteger first = 1, last = 0;
+    for (; last < 1000; last++)
+        rt.table_set(t, rt.create_integer(last + 1), rt.create_boolean(true));
+    size_t peak = table->capacity();
+    // drain to a handful of entries, then push and pop for a long time
+    for (; first < 995; first++)
+        rt.table_set(t, rt.create_integer(first), rt.create_nil());
+    for (linteger i = 0; i < 100000; i++)
+    {
+        rt.table_set(t, rt.create_integer(++last), rt.create_boolean(true));
+        rt.table_set(t, rt.create_integer(first++), rt.create_nil());
+    }
+    rt_assert(table->capacity() <= peak, mes, 1);
+    rt_assert(table->capacity() <= 128, mes, 2);
+    bool found = true;
+    for (linteger i = first; i <= last; i++)
+        found = found && rt.table_get(t, rt.create_integer(i)).kind == LuaType::LVBool;
+    rt_assert(found && rt.table_get(t, rt.create_integer(first - 1)).kind == LuaType::LVNil, mes, 3);
+}
+
+void test_table_presized()
+{
+    const char *mes = "presized table";
+    LuaRuntime rt(nullptr);
+    LuaValue t = rt.create_table(100, 40);
+    Table *table = t.as<Table *>();
+    size_t cap = table->capacity();
+    for (linteger i = 1; i <= 100; i++)
+        rt.table_set(t, rt.create_integer(i), rt.create_integer(i));
+    for (linteger i = 0; i < 20; i++)
+        rt.table_set(t, rt.create_string(i + 0.5), rt.create_integer(i));
+    rt_assert(table->capacity() == cap, mes, 1);
+    rt_assert(rt.table_length(t) == 100, mes, 2);
+    // the fields move to a set that still has room for all the keys
+    rt.table_set(t, rt.create_number(0.5), rt.create_integer(0));
+    cap = table->capacity();
+    for (linteger i = 1; i < 20; i++)
+        rt.table_set(t, rt.create_number(i + 0.5), rt.create_integer(i));
+    rt_assert(table->capacity() == cap, mes, 3);
+    rt_assert(rt.table_get(t, rt.create_string(3.5)) == rt.create_integer(3), mes, 4);
+}
+
+void test_table_shapes()
+{
+    const char *mes = "table shapes";
+    LuaRuntime rt(nullptr);
+    LuaValue a = rt.create_table();
+    LuaValue b = rt.create_table();
+    LuaValue c = rt.create_table();
+    LuaValue keys[] = {rt.create_string("x"), rt.create_string("y"), rt.create_string("z")};
+    for (linteger i = 0; i < 3; i++)
+    {
+        rt.table_set(a, keys[i], rt.create_integer(i));
+        rt.table_set(b, keys[i], rt.create_integer(i * 2));
+        rt.table_set(c, keys[2 - i], rt.create_integer(i));
+    }
+    Table *ta = a.as<Table *>();
+    Table *tb = b.as<Table *>();
+    Table *tc = c.as<Table *>();
+    rt_assert(ta->get_shape() == tb->get_shape() && ta->get_shape()->size() == 3, mes, 1);
+    rt_assert(ta->get_shape() != tc->get_shape() && tc->get_shape()->size() == 3, mes, 2);
+
+    // a cleared field keeps its slot and the shape
+    rt.table_set(a, keys[1], rt.create_nil());
+    size_t count = 0;
+    TableIterator it = ta->iter();
+    while (it.next())
+        count++;
+    rt_assert(count == 2 && ta->get_shape() == tb->get_shape(), mes, 3);
+
+    FieldCache cache = {nullptr, 0};
+    rt_assert(tb->get(keys[1], &cache) == rt.create_integer(2) && cache.shape == tb->get_shape(), mes, 4);
+    rt_assert(ta->get(keys[1], &cache).kind == LuaType::LVNil, mes, 5);
+    rt_assert(tc->get(keys[1], &cache) == rt.create_integer(1) && cache.shape == tc->get_shape(), mes, 6);
+    tc->set(keys[1], rt.create_integer(7), &cache);
+    tb->set(keys[1], rt.create_integer(8), &cache);
+    rt_assert(rt.table_get(c, keys[1]) == rt.create_integer(7), mes, 7);
+    rt_assert(rt.table_get(b, keys[1]) == rt.create_integer(8) && cache.shape == tb->get_shape(), mes, 8);
+
+    // a site that adds a key moves the next table along the same edge
+    FieldCache add = {nullptr, 0, nullptr};
+    LuaValue e = rt.create_table();
+    LuaValue f = rt.create_table();
+    e.as<Table *>()->set(keys[0], rt.create_integer(1), &add);
+    rt_assert(add.shape == rt.shape_root() && add.next == e.as<Table *>()->get_shape(), mes, 9);
+    f.as<Table *>()->set(keys[0], rt.create_integer(2), &add);
+    rt_assert(f.as<Table *>()->get_shape() == add.next && rt.table_get(f, keys[0]) == rt.create_integer(2), mes, 10);
+
+    // any other key turns the table into a dictionary
+    rt.table_set(a, rt.create_number(1.5), rt.create_boolean(true));
+    rt_assert(!ta->get_shape() && rt.table_get(a, keys[2]) == rt.create_integer(2), mes, 11);
+    rt_assert(ta->get(keys[2], &cache) == rt.create_integer(2), mes, 12);
+
+    // so do too many keys
+    LuaValue d = rt.create_table();
+    for (linteger i = 0; i <= SHAPE_MAX_KEYS; i++)
+        rt.table_set(d, rt.create_string((lnumber)i), rt.create_integer(i));
+    bool found = true;
+    for (linteger i = 0; i <= SHAPE_MAX_KEYS; i++)
+        found = found && rt.table_get(d, rt.create_string((lnumber)i)) == rt.create_integer(i);
+    rt_assert(!d.as<Table *>()->get_shape() && found, mes, 13);
+}
+
+void test_key_hashing()
+{
+    const char *mes = "table key hashing";
+    LuaRuntime rt(nullptr);
+    hash_t one = luavalue_hash(rt.create_integer(1));
+    rt_assert(luavalue_hash(rt.create_number(1.0)) == one, mes, 1);
+    rt_assert(luavalue_hash(rt.create_number(1.25)) != one, mes, 2);
+    rt_assert(luavalue_hash(rt.create_number(1.5)) != luavalue_hash(rt.create_number(1.25)), mes, 3);
+    LuaValue s1 = rt.create_string("key");
+    LuaValue s2 = rt.create_string("k", "ey");
+    rt_assert(luavalue_hash(s1) == luavalue_hash(s2), mes, 4);
+    rt_assert(luavalue_hash(s1) != luavalue_hash(rt.create_string("kez")), mes, 5);
 }
 
 void test_calls()
 {
     test_cxx_calls_cxx();
     test_lua_calls_cxx();
+    test_cxx_reads_args();
+}
+
+// the slot of a freed object starts with the free tag
+static bool heap_contains(void *obj)
+{
+    return *(uint8_t *)(((gc_header_t *)obj) - 1) != ARENA_FREE;
+}
+void test_incremental_gc()
+{
+    const char *mes = "incremental gc";
+    LuaRuntime rt(nullptr);
+    GarbageCollector *gc = rt.collector();
+    LuaValue t = rt.create_table();
+    rt.stack_push(t);
+    for (linteger i = 1; i <= 100; i++)
+        rt.table_set(t, rt.create_integer(i), rt.create_table());
+    void *garbage = rt.create_table().data.ptr;
+
+    // the roots are scanned, the children of t still wait
+    gc->step(2);
+    rt_assert(gc->get_phase() == GCPhase::GCMark, mes, 1);
+
+    // stored in a table that was already scanned, only the barrier keeps it
+    LuaValue s = rt.create_string("created while marking");
+    rt.table_set(t, rt.create_integer(101), s);
+    while (!gc->step(1))
+        ;
+    rt_assert(gc->get_phase() == GCPhase::GCIdle, mes, 2);
+    rt_assert(heap_contains(s.as<lstr_p>() - 1), mes, 3);
+    rt_assert(heap_contains(rt.table_get(t, rt.create_integer(100)).data.ptr), mes, 4);
+    rt_assert(!heap_contains(garbage), mes, 5);
+    rt_assert(strcmp(rt.table_get(t, rt.create_integer(101)).str(), "created while marking") == 0, mes, 6);
+}
+static bool is_old(void *obj)
+{
+    return (((gc_header_t *)obj) - 1)->age == GC_PROMOTE_AGE;
+}
+static bool is_remembered(void *obj)
+{
+    return (((gc_header_t *)obj) - 1)->remembered;
+}
+void test_generational_gc()
+{
+    const char *mes = "generational gc";
+    LuaRuntime rt(nullptr);
+    rt.set_generational_gc(true);
+    GarbageCollector *gc = rt.collector();
+    LuaValue t = rt.create_table();
+    rt.stack_push(t);
+    rt.stack_push(rt.create_table());
+    void *lost = rt.create_table().data.ptr;
+    gc->run();
+    void *dropped = rt.stack_pop().data.ptr;
+    rt_assert(is_old(t.data.ptr) && !heap_contains(lost), mes, 1);
+
+    LuaValue young = rt.create_table();
+    rt.table_set(t, rt.create_integer(1), young);
+    void *garbage = rt.create_table().data.ptr;
+    rt_assert(is_remembered(t.data.ptr), mes, 2);
+    gc->minor();
+    rt_assert(heap_contains(young.data.ptr) && !heap_contains(garbage), mes, 3);
+    rt_assert(!is_old(young.data.ptr) && is_remembered(t.data.ptr), mes, 4);
+    gc->minor();
+    rt_assert(is_old(young.data.ptr) && !is_remembered(t.data.ptr), mes, 5);
+
+    // a promoted table keeps the young one it points to
+    LuaValue parent = rt.create_table();
+    rt.table_set(t, rt.create_integer(2), parent);
+    gc->minor();
+    LuaValue child = rt.create_table();
+    rt.table_set(parent, rt.create_integer(1), child);
+    gc->minor();
+    rt_assert(is_old(parent.data.ptr) && !is_old(child.data.ptr) && is_remembered(parent.data.ptr), mes, 6);
+    gc->minor();
+    rt_assert(heap_contains(child.data.ptr) && is_old(child.data.ptr), mes, 7);
+
+    // old garbage waits for a full collection
+    rt_assert(heap_contains(dropped), mes, 8);
+    gc->run();
+    rt_assert(!heap_contains(dropped) && heap_contains(child.data.ptr), mes, 9);
+}
+void test_arena()
+{
+    const char *mes = "arena";
+    Arena arena;
+    void *a = arena.allocate(1);
+    void *b = arena.allocate(ARENA_GRANULE);
+    void *c = arena.allocate(ARENA_MAX_SIZE);
+    rt_assert(Arena::size(a) == ARENA_GRANULE && Arena::size(c) == ARENA_MAX_SIZE, mes, 1);
+    rt_assert((char *)b - (char *)a == ARENA_GRANULE && (uintptr_t)a % ARENA_GRANULE == 0, mes, 2);
+    ArenaStats stats = arena.stats();
+    rt_assert(stats.mapped == 2 * ARENA_PAGE_SIZE && stats.used == 2 * ARENA_GRANULE + ARENA_MAX_SIZE, mes, 3);
+    arena.deallocate(a);
+    rt_assert(arena.allocate(ARENA_GRANULE) == a, mes, 4);
+    arena.deallocate(c);
+    stats = arena.stats();
+    rt_assert(stats.empty == ARENA_PAGE_SIZE && stats.free == ARENA_PAGE_SIZE - stats.used, mes, 5);
+    Arena::mark(b);
+    rt_assert(Arena::marked(b) && !Arena::marked(a), mes, 6);
+    arena.clear_marks();
+    rt_assert(!Arena::marked(b), mes, 7);
+    arena.deallocate(a);
+    arena.deallocate(b);
+
+    // the pages of a collected heap are unmapped but the spares
+    LuaRuntime rt(nullptr);
+    LuaValue t = rt.create_table();
+    rt.stack_push(t);
+    for (linteger i = 1; i <= 10000; i++)
+        rt.table_set(t, rt.create_integer(i), rt.create_table());
+    rt_assert(((gc_header_t *)t.data.ptr - 1)->size_class, mes, 8);
+    size_t mapped = rt.arena_stats().mapped;
+    rt.stack_pop();
+    rt.collector()->run();
+    stats = rt.arena_stats();
+    rt_assert(mapped > 2 * ARENA_SPARE_PAGES * ARENA_PAGE_SIZE && stats.empty == ARENA_SPARE_PAGES * ARENA_PAGE_SIZE, mes, 9);
+    rt_assert(stats.mapped - stats.empty == ARENA_PAGE_SIZE, mes, 10);
+}
+void test_parallel_mark()
+{
+    const char *mes = "parallel mark";
+    LuaRuntime rt(nullptr);
+    rt.set_gc_threads(4);
+    LuaValue root = rt.create_table();
+    rt.stack_push(root);
+    // wide tables for the markers to share and a long chain to steal from
+    LuaValue last = root;
+    linteger count = 0;
+    while (rt.arena_stats().used < GC_PARALLEL_HEAP)
+    {
+        LuaValue t = rt.create_table();
+        rt.table_set(root, rt.create_integer(++count), t);
+        rt.table_set(last, rt.create_string("next"), t);
+        last = t;
+        for (linteger i = 1; i <= 8; i++)
+            rt.table_set(t, rt.create_integer(i), rt.create_table());
+    }
+    LuaValue big = rt.create_string(std::string(1000, 'x').c_str());
+    rt.table_set(last, rt.create_string("big"), big);
+    void *garbage = rt.create_table().data.ptr;
+    rt.collector()->run();
+
+    // the survivors are left marked until the next cycle starts
+    bool marked = Marker::is_marked((gc_header_t *)(big.as<lstr_p>() - 1) - 1);
+    for (linteger i = 1; i <= count && marked; i++)
+    {
+        LuaValue t = rt.table_get(root, rt.create_integer(i));
+        marked = Marker::is_marked((gc_header_t *)t.data.ptr - 1);
+        for (linteger j = 1; j <= 8 && marked; j++)
+            marked = Marker::is_marked((gc_header_t *)rt.table_get(t, rt.create_integer(j)).data.ptr - 1);
+    }
+    rt_assert(marked, mes, 1);
+    rt_assert(!heap_contains(garbage), mes, 2);
+    rt_assert(strcmp(rt.table_get(last, rt.create_string("big")).str(), big.str()) == 0, mes, 3);
 }
 
 void runtime_tests()
 {
     test_pushpop();
     test_create_values();
+    test_value_encoding();
     test_calls();
     test_string();
+    test_binary_predecode();
+    test_table_parts();
+    test_table_churn();
+    test_table_shrinking();
+    test_table_queue();
+    test_table_presized();
+    test_table_shapes();
+    test_key_hashing();
+    test_incremental_gc();
+    test_generational_gc();
+    test_arena();
+    test_parallel_mark();
 }
\ No newline at end of file
@@ -27,7 +27,7 @@ vector<LuaValue> luayed::drain(LuaRuntime *rt)
 LuaValue luayed::lvclone(LuaRuntime *rt, const LuaValue &v)
 {
     if (v.kind == LuaType::LVString)
-        return rt->create_string(v.as<const char *>());
+        return rt->create_string(v.str());
     if (v.kind == LuaType::LVTable)
         return rt->create_table();
     else
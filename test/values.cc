@@ -9,6 +9,8 @@
 using namespace luayed;
 
 std::set<string> strset;
+// the boxes of the integers too wide for a NaN-boxed value
+std::set<linteger> intset;
 std::vector<vector<LuaValue> *> tabset;
 
 void luayed::tabset_detroy()
@@ -40,6 +42,19 @@ LuaValue luayed::lvnumber(lnumber n)
     v.data.n = n;
     return v;
 }
+LuaValue luayed::lvinteger(linteger n)
+{
+    LuaValue v;
+#ifdef LUAYED_NAN_BOXING
+    if (!LuaValue::fits_int(n))
+    {
+        v.set_boxed_int((linteger *)&*intset.insert(n).first);
+        return v;
+    }
+#endif
+    v.set_int(n);
+    return v;
+}
 LuaValue luayed::lvstring(const char *s)
 {
     string str = s;
@@ -12,6 +12,7 @@ namespace luayed
     LuaValue lvnil();
     LuaValue lvbool(bool b);
     LuaValue lvnumber(lnumber n);
+    LuaValue lvinteger(linteger n);
     LuaValue lvstring(const char *s);
     LuaValue lvtable();
     LuaValue lvclone(LuaRuntime *rt, const LuaValue &v);